@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <mutex>
 
 namespace boo {
 
@@ -10,11 +11,15 @@ class IObj {
 protected:
   virtual ~IObj() = default;
 
+  /** Held while the last reference deletes the object, e.g. to unlink it from a list shared with other threads */
+  virtual std::unique_lock<std::recursive_mutex> destructorLock() { return {}; }
+
 public:
   void increment() noexcept { m_refCount.fetch_add(1, std::memory_order_relaxed); }
   void decrement() noexcept {
     if (m_refCount.fetch_sub(1, std::memory_order_release) == 1) {
       std::atomic_thread_fence(std::memory_order_acquire);
+      auto lk = destructorLock();
       delete this;
     }
   }
@@ -13,11 +13,15 @@ struct IAudioSubmixCallback;
 
 enum class SubmixFormat { Int16, Int32, Float };
 
+/** Byte alignment of every channel buffer handed to the planar applyEffect() */
+constexpr size_t AudioPlanarAlignment = 64;
+
 struct IAudioSubmix : IObj {
-  /** Reset channel-levels to silence; unbind all submixes */
+  /** Reset channel-levels to silence; unbind all submixes (from the start of the next mix quantum) */
   virtual void resetSendLevels() = 0;
 
-  /** Set channel-levels for target submix (AudioChannel enum for array index) */
+  /** Set channel-levels for target submix (AudioChannel enum for array index);
+   *  takes effect at the start of the next mix quantum, binding the submix if necessary */
   virtual void setSendLevel(IAudioSubmix* submix, float level, bool slew) = 0;
 
   /** Gets fixed sample rate of submix this way */
@@ -36,6 +40,18 @@ struct IAudioSubmixCallback {
   virtual void applyEffect(int32_t* audio, size_t frameCount, const ChannelMap& chanMap, double sampleRate) const = 0;
   virtual void applyEffect(float* audio, size_t frameCount, const ChannelMap& chanMap, double sampleRate) const = 0;
 
+  /** Client-provided claim to take planar audio in applyEffect(); the interleaved overloads are used otherwise */
+  virtual bool wantsPlanarEffect() const { return false; }
+
+  /** Client-provided effect solution for planar, master sample-rate audio; channels[c] holds frameCount
+   *  contiguous samples of chanMap.m_channels[c], starting on an AudioPlanarAlignment boundary */
+  virtual void applyEffect(int16_t* const* channels, size_t frameCount, const ChannelMap& chanMap,
+                           double sampleRate) const {}
+  virtual void applyEffect(int32_t* const* channels, size_t frameCount, const ChannelMap& chanMap,
+                           double sampleRate) const {}
+  virtual void applyEffect(float* const* channels, size_t frameCount, const ChannelMap& chanMap,
+                           double sampleRate) const {}
+
   /** Notify of output sample rate changes (for instance, changing the default audio device on Windows) */
   virtual void resetOutputSampleRate(double sampleRate) = 0;
 };
@@ -23,6 +23,22 @@ enum class AudioChannel {
   Unknown = 0xff
 };
 
+/** Resampler filter quality; lower tiers trade passband fidelity for CPU time */
+enum class AudioVoiceQuality {
+  Quick,   /* Cubic interpolation */
+  Low,     /* 16-bit with large rolloff */
+  Medium,  /* 16-bit with medium rolloff */
+  High,    /* 20-bit (default) */
+  VeryHigh /* 28-bit */
+};
+
+/** Sample format the client supplies to a voice; int32 and float sources skip quantizing to int16 */
+enum class AudioSourceFormat {
+  Int16, /* Full scale at +/-32768 */
+  Int32, /* Full scale at +/-2^31 */
+  Float  /* Full scale at +/-1.0 */
+};
+
 struct ChannelMap {
   unsigned m_channelCount = 0;
   std::array<AudioChannel, 8> m_channels{};
@@ -44,10 +60,15 @@ static inline unsigned ChannelCount(AudioChannelSet layout) {
   return 0;
 }
 
+/** Setters may be called from any thread; changes are queued and take effect together at the start of
+ *  the next mix quantum, or immediately when made from a callback running on a mixing thread */
 struct IAudioVoice : IObj {
   /** Set sample rate into voice (may result in audio discontinuities) */
   virtual void resetSampleRate(double sampleRate) = 0;
 
+  /** Set resampler quality of voice (may result in audio discontinuities) */
+  virtual void setResamplerQuality(AudioVoiceQuality quality) = 0;
+
   /** Reset channel-levels to silence; unbind all submixes */
   virtual void resetChannelLevels() = 0;
 
@@ -60,9 +81,16 @@ struct IAudioVoice : IObj {
   /** Called by client to dynamically adjust the pitch of voices with dynamic pitch enabled */
   virtual void setPitchRatio(double ratio, bool slew) = 0;
 
+  /** Rank this voice for the engine's real-voice budget; higher priorities stay audible first (default 0) */
+  virtual void setPriority(int priority) = 0;
+
   /** Instructs platform to begin consuming sample data; invoking callback as needed */
   virtual void start() = 0;
 
+  /** Streaming voices hold their position, mixing nothing, until the first fill of their prefetch ring lands;
+   *  returns true from then on (and always for other voices). Start once primed for an exact onset */
+  virtual bool isPrimed() const = 0;
+
   /** Instructs platform to stop consuming sample data */
   virtual void stop() = 0;
 };
@@ -73,9 +101,20 @@ struct IAudioVoiceCallback {
   virtual void preSupplyAudio(boo::IAudioVoice& voice, double dt) = 0;
 
   /** boo calls this on behalf of the audio platform to request more audio
-   *  frames from the client */
+   *  frames from the client; only the overload matching the AudioSourceFormat
+   *  the voice was allocated with is called. The Int16 overload is always required;
+   *  clients allocating Int32 or Float voices override that format's overload too */
   virtual size_t supplyAudio(IAudioVoice& voice, size_t frames, int16_t* data) = 0;
 
+  virtual size_t supplyAudio(IAudioVoice& voice, size_t frames, int32_t* data) { return 0; }
+
+  virtual size_t supplyAudio(IAudioVoice& voice, size_t frames, float* data) { return 0; }
+
+  /** boo calls this instead of supplyAudio while every send of the voice is silent or the voice is virtual;
+   *  client advances its playback position by the requested frames without decoding them.
+   *  Returning false (the default) makes boo request and discard the frames via supplyAudio */
+  virtual bool skipAudio(IAudioVoice& voice, size_t frames) { return false; }
+
   /** after resampling, boo calls this for each submix that this voice targets;
    *  client performs volume processing and bus-routing this way */
   virtual void routeAudio(size_t frames, size_t channels, double dt, int busId, int16_t* in, int16_t* out) {
@@ -91,4 +130,17 @@ struct IAudioVoiceCallback {
   }
 };
 
+/** Decoder behind a streaming voice (see IAudioVoiceEngine::allocateNewStreamingVoice).
+ *  boo calls it from a background stream thread to keep the voice's prefetch ring filled, never from a
+ *  mixing thread, and never concurrently for the same voice; only the overload matching the voice's
+ *  AudioSourceFormat is called */
+struct IAudioStreamSource {
+  /** Decode up to frames interleaved frames into data; returning fewer ends the stream after they play */
+  virtual size_t readAudio(size_t frames, int16_t* data) { return 0; }
+
+  virtual size_t readAudio(size_t frames, int32_t* data) { return 0; }
+
+  virtual size_t readAudio(size_t frames, float* data) { return 0; }
+};
+
 } // namespace boo
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -12,19 +13,70 @@
 #include "boo/audiodev/IMIDIPort.hpp"
 
 namespace boo {
+struct IAudioVoice;
 struct IAudioVoiceEngine;
 
-/** Time-sensitive event callback for synchronizing the client with rendered audio waveform */
+/** Time-sensitive event callback for synchronizing the client with rendered audio waveform;
+ *  invoked on the pumping thread, which is the engine's realtime thread under setRealtimeThread */
 struct IAudioVoiceEngineCallback {
-  /** All mixing occurs in virtual 5ms intervals;
+  /** All mixing occurs in virtual intervals of one mix quantum (5ms unless set by setMixQuantum);
    *  this is called at the start of each interval for all mixable entities */
   virtual void on5MsInterval(IAudioVoiceEngine& engine, double dt) {}
 
+  /** Client-provided claim to update voices through preSupplyVoices() instead of per-voice
+   *  IAudioVoiceCallback::preSupplyAudio() calls */
+  virtual bool batchesPreSupply() const { return false; }
+
+  /** Called once per interval, before any voice is pumped, with every running voice in a contiguous array;
+   *  voices started or stopped from here are picked up by the following interval */
+  virtual void preSupplyVoices(IAudioVoiceEngine& engine, IAudioVoice* const* voices, size_t count, double dt) {}
+
   /** When a pumping cycle is complete this is called to allow the client to
    *  perform periodic cleanup tasks */
   virtual void onPumpCycleComplete(IAudioVoiceEngine& engine) {}
 };
 
+/** Throughput report of an offline render pass */
+struct AudioRenderStats {
+  size_t m_frames = 0;            /**< Frames mixed and written */
+  double m_wallSeconds = 0.0;     /**< Wall-clock time spent rendering */
+  double m_framesPerSecond = 0.0; /**< m_frames / m_wallSeconds */
+  double m_realtimeFactor = 0.0;  /**< Seconds of audio rendered per wall-clock second */
+  uint64_t m_checksum = 0;        /**< Hash of all output mixed so far, from engines that compute one */
+};
+
+/** Mixer health since the last resetStats(); times are wall-clock seconds */
+struct AudioEngineStats {
+  size_t m_pumps = 0;                   /**< Pump cycles measured */
+  double m_pumpMinSeconds = 0.0;        /**< Shortest pump cycle */
+  double m_pumpMeanSeconds = 0.0;       /**< Average pump cycle */
+  double m_pumpP99Seconds = 0.0;        /**< 99th percentile pump cycle (histogram estimate, ~10% resolution) */
+  double m_pumpMaxSeconds = 0.0;        /**< Longest pump cycle */
+  double m_voiceSeconds = 0.0;          /**< Total time spent resampling and mixing voices */
+  double m_submixSeconds = 0.0;         /**< Total time spent in submix effects and sends */
+  double m_ltRtSeconds = 0.0;           /**< Total time spent in Lt/Rt encoding */
+  size_t m_activeVoices = 0;            /**< Running voices in the most recent mix quantum */
+  size_t m_silentVoices = 0;            /**< Real (non-virtual) running voices that were silent that quantum */
+  size_t m_virtualVoices = 0;           /**< Running voices skipped for exceeding the real-voice budget */
+  size_t m_totalVoices = 0;             /**< Allocated voices in that quantum */
+  size_t m_underruns = 0;               /**< Times the device ran out of mixed audio */
+  double m_deviceLatencySeconds = -1.0; /**< Output latency reported by the device, or negative if unknown */
+};
+
+/** Range of mix quantum sizes accepted by IAudioVoiceEngine::setMixQuantum */
+constexpr size_t MinMixQuantumFrames = 64;
+constexpr size_t MaxMixQuantumFrames = 1024;
+
+/** Placement of one voice for IAudioVoiceEngine::setVoicePans */
+struct AudioVoicePan {
+  IAudioVoice* m_voice = nullptr;        /**< Voice whose send levels are replaced; entries without one are skipped */
+  IAudioSubmix* m_submix = nullptr;      /**< Send to set, or null for the main output */
+  float m_position[3] = {0.f, 0.f, 1.f}; /**< Listener-relative source position; +x right, +y up, +z ahead */
+  float m_spread = 0.f;                  /**< 0 for a point source, up to 1 for even power on all speakers */
+  float m_width = 0.f;                   /**< Stereo voices: separation of the two channels (1 for 90 degrees) */
+  float m_gain = 1.f;                    /**< Amplitude of the source; its speaker levels sum to this in power */
+};
+
 /** Mixing and sample-rate-conversion system. Allocates voices and mixes them
  *  before sending the final samples to an OS-supplied audio-queue */
 struct IAudioVoiceEngine {
@@ -35,14 +87,40 @@ struct IAudioVoiceEngine {
    *  ChannelLayout automatically reduces to maximum-supported layout by HW.
    *
    *  Client must be prepared to supply audio frames via the callback when this is called;
-   *  the backing audio-buffers are primed with initial data for low-latency playback start
+   *  the backing audio-buffers are primed with initial data for low-latency playback start.
+   *  Quality selects the resampler filter; cheap tiers suit short sound effects.
+   *  Format selects which supplyAudio overload the callback receives source frames through
    */
   virtual ObjToken<IAudioVoice> allocateNewMonoVoice(double sampleRate, IAudioVoiceCallback* cb,
-                                                     bool dynamicPitch = false) = 0;
+                                                     bool dynamicPitch = false,
+                                                     AudioVoiceQuality quality = AudioVoiceQuality::High,
+                                                     AudioSourceFormat format = AudioSourceFormat::Int16) = 0;
 
   /** Same as allocateNewMonoVoice, but source audio is stereo-interleaved */
   virtual ObjToken<IAudioVoice> allocateNewStereoVoice(double sampleRate, IAudioVoiceCallback* cb,
-                                                       bool dynamicPitch = false) = 0;
+                                                       bool dynamicPitch = false,
+                                                       AudioVoiceQuality quality = AudioVoiceQuality::High,
+                                                       AudioSourceFormat format = AudioSourceFormat::Int16) = 0;
+
+  /** Same as allocateNewMonoVoice (1 channel) or allocateNewStereoVoice (2 channels), but source audio comes
+   *  from a ring that background stream threads keep about prefetchSeconds ahead of playback by reading source;
+   *  the mixing thread only copies out of it. cb receives preSupplyAudio and routeAudio but never supplyAudio
+   *  (its required Int16 overload may simply return 0).
+   *  Returns without reading source; the first fill runs on a stream thread, and until it lands the voice holds
+   *  its position and mixes nothing (see IAudioVoice::isPrimed). Should the ring later run dry, the voice
+   *  plays silence until it catches up */
+  virtual ObjToken<IAudioVoice> allocateNewStreamingVoice(double sampleRate, unsigned channels, IAudioVoiceCallback* cb,
+                                                          IAudioStreamSource* source, double prefetchSeconds = 0.5,
+                                                          bool dynamicPitch = false,
+                                                          AudioVoiceQuality quality = AudioVoiceQuality::High,
+                                                          AudioSourceFormat format = AudioSourceFormat::Int16) = 0;
+
+  /** Pre-create resamplers for voices of the specified source rate, channel count (1 or 2) and options,
+   *  so that allocating up to count such voices performs no filter design (e.g. during level load).
+   *  Resamplers are returned to the engine when voices are destroyed or reset */
+  virtual void warmResamplers(double sampleRate, unsigned channels, size_t count, bool dynamicPitch = false,
+                              AudioVoiceQuality quality = AudioVoiceQuality::High,
+                              AudioSourceFormat format = AudioSourceFormat::Int16) = 0;
 
   /** Client calls this to allocate a Submix for gathering audio together for effects processing */
   virtual ObjToken<IAudioSubmix> allocateNewSubmix(bool mainOut, IAudioSubmixCallback* cb, int busId) = 0;
@@ -56,9 +134,67 @@ struct IAudioVoiceEngine {
   /** Ensure backing platform buffer is filled as much as possible with mixed samples */
   virtual void pumpAndMixVoices() = 0;
 
+  /** Offline engines render this many frames as fast as possible in large blocks
+   *  (without waiting on a device or the client); realtime engines render nothing */
+  virtual AudioRenderStats renderFrames(size_t frames) = 0;
+
+  /** Same as renderFrames, but duration is expressed in seconds at the mix sample-rate */
+  virtual AudioRenderStats renderSeconds(double seconds) = 0;
+
+  /** Snapshot of mixer timing and load; cheap enough to poll every frame.
+   *  Pump-side collection is always on and adds a few clock reads per mix quantum */
+  virtual AudioEngineStats getStats() const = 0;
+
+  /** Restart accumulation of getStats() values */
+  virtual void resetStats() = 0;
+
+  /** Render from an engine-owned high-priority thread whenever the device requests audio, allowing much
+   *  smaller output buffers; pumpAndMixVoices does nothing while enabled. Voice, submix and engine callbacks
+   *  (including on5MsInterval, preSupplyAudio and onPumpCycleComplete) then run on that SCHED_FIFO thread and
+   *  must not block. While another thread is creating, destroying or reconfiguring voices or submixes, rendering
+   *  is retried shortly instead of waiting; only if that outlasts the device buffer is a period of silence
+   *  written. Returns false if the backend does not support it or setup failed */
+  virtual bool setRealtimeThread(bool enable) = 0;
+
+  /** Distribute voice resampling and mixing across this many threads (including the pumping thread).
+   *  With more than one thread, IAudioVoiceCallback methods of different voices may be invoked concurrently.
+   *  Takes effect at the start of the next mix quantum */
+  virtual void setMixThreadCount(size_t count) = 0;
+
+  /** Read the sources of streaming voices on this many background threads (default 1) */
+  virtual void setStreamThreadCount(size_t count) = 0;
+
   /** Set total volume of engine */
   virtual void setVolume(float vol) = 0;
 
+  /** Mix in quanta of this many frames (a power of two from MinMixQuantumFrames to MaxMixQuantumFrames), or pass 0
+   *  to restore the default 5ms quanta. Voice, submix and engine callbacks run once per quantum: small quanta react
+   *  sooner to parameter changes, large quanta amortize per-voice and per-effect overhead in offline renders.
+   *  Device buffer sizes are unaffected. With Lt/Rt encoding enabled, quanta are also split at the encoder's
+   *  10ms half windows. Returns false for an unsupported size */
+  virtual bool setMixQuantum(size_t frames) = 0;
+
+  /** Frames in each full mix quantum */
+  virtual size_t getMixQuantum() const = 0;
+
+  /** Resample and mix at most this many audible voices per quantum (0, the default, for no limit).
+   *  Running voices are ranked by IAudioVoice::setPriority, then by their loudest send gain towards the main
+   *  output; voices outside the budget become virtual and advance through IAudioVoiceCallback::skipAudio
+   *  until they win a slot back */
+  virtual void setVoiceBudget(size_t realVoices) = 0;
+
+  /** Pan many voices at once onto the speakers of getAvailableSet(), replacing each entry's send levels as
+   *  IAudioVoice::setMonoChannelLevels or setStereoChannelLevels would. Levels are computed in vectorized
+   *  batches; from preSupplyVoices() they apply to the interval about to be mixed */
+  virtual void setVoicePans(const AudioVoicePan* pans, size_t count, bool slew) = 0;
+
+  /** On integer output devices, accumulate voices and submixes in float and convert to the device format once per
+   *  sample after the master volume, clipping only there (optionally TPDF-dithered on 16-bit devices; 32-bit
+   *  output is never dithered). Submix effect callbacks then receive float buffers (see
+   *  IAudioSubmix::getSampleFormat). Float devices always mix in float.
+   *  Voices re-create their resamplers; must not be called while voices are being pumped */
+  virtual void setFloatMix(bool enable, bool dither = false) = 0;
+
   /** Enable or disable Lt/Rt surround encoding. If successful, getAvailableSet() will return Surround51 */
   virtual bool enableLtRt(bool enable) = 0;
 
@@ -105,7 +241,19 @@ struct IAudioVoiceEngine {
 /** Construct host platform's voice engine */
 std::unique_ptr<IAudioVoiceEngine> NewAudioVoiceEngine();
 
-/** Construct WAV-rendering voice engine */
-std::unique_ptr<IAudioVoiceEngine> NewWAVAudioVoiceEngine(const char* path, double sampleRate, int numChans);
+/** Sample encoding of files written by the WAV-rendering voice engine */
+enum class WAVFormat { Float32, Int16, Int24 };
+
+/** Construct WAV-rendering voice engine; integer formats may optionally be TPDF-dithered */
+std::unique_ptr<IAudioVoiceEngine> NewWAVAudioVoiceEngine(const char* path, double sampleRate, int numChans,
+                                                          WAVFormat format = WAVFormat::Float32, bool dither = false);
+
+/** Construct device-less voice engine for headless benchmarks and CI. Mixes the full voice/submix graph at any
+ *  rate and format, but only when pumpAndMixVoices (one 5ms block) or renderFrames is called, then discards the
+ *  output. With checksum set, renderFrames reports a running hash of every sample mixed; Int16 resampling is
+ *  dithered with a time-seeded generator, so only Int32 and Float hashes are reproducible between runs */
+std::unique_ptr<IAudioVoiceEngine> NewNullAudioVoiceEngine(double sampleRate, int numChans,
+                                                           SubmixFormat format = SubmixFormat::Float,
+                                                           bool checksum = false);
 
 } // namespace boo
@@ -34,7 +34,8 @@ public:
 
 /** Linked-list IObj node made part of objects participating in list.
  *  Subclasses must implement static methods _getHeadPtr() and _getHeadLock()
- *  to support the common list-management functionality.
+ *  to support the common list-management functionality; the head lock is held
+ *  while nodes link themselves in and while the last reference destroys them.
  */
 template <class N, class H, class P = IObj>
 struct ListNode : P {
@@ -54,6 +55,8 @@ struct ListNode : P {
   }
 
 protected:
+  std::unique_lock<std::recursive_mutex> destructorLock() override { return N::_getHeadLock(m_head); }
+
   ~ListNode() {
     if (m_prev) {
       if (m_next)
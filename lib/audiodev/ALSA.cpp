@@ -0,0 +1,323 @@
+#include "lib/audiodev/AudioVoiceEngine.hpp"
+
+#include "lib/audiodev/LinuxMidi.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+#include <alsa/asoundlib.h>
+#include <logvisor/logvisor.hpp>
+
+namespace boo {
+
+/* Device ring length in periods; the client must pump before this much audio has played out */
+constexpr snd_pcm_uframes_t ALSABufferPeriods = 8;
+
+/** Drives an ALSA PCM directly, bypassing any sound server.
+ *  The device ring is mapped into the process and voices are mixed straight into it in the device's
+ *  own sample format, so each pump performs no intermediate copy or conversion. */
+struct ALSAAudioVoiceEngine : LinuxMidi {
+  snd_pcm_t* m_pcm = nullptr;
+  std::string m_deviceName;
+
+  /* Channel count of the device's native layout, or stereo where the device accepts it */
+  static unsigned _chooseChannelCount(snd_pcm_t* pcm, snd_pcm_hw_params_t* hwParams) {
+    unsigned minChans = 2;
+    snd_pcm_hw_params_get_channels_min(hwParams, &minChans);
+    for (unsigned chans : {2u, 4u, 6u, 8u})
+      if (chans >= minChans && !snd_pcm_hw_params_test_channels(pcm, hwParams, chans))
+        return chans;
+    return 0;
+  }
+
+  void _parseChannelMap(unsigned chanCount) {
+    ChannelMap& chmapOut = m_mixInfo.m_channelMap;
+    chmapOut.m_channelCount = chanCount;
+    switch (chanCount) {
+    case 2:
+    default:
+      m_mixInfo.m_channels = AudioChannelSet::Stereo;
+      break;
+    case 4:
+      m_mixInfo.m_channels = AudioChannelSet::Quad;
+      break;
+    case 6:
+      m_mixInfo.m_channels = AudioChannelSet::Surround51;
+      break;
+    case 8:
+      m_mixInfo.m_channels = AudioChannelSet::Surround71;
+      break;
+    }
+
+    /* ALSA's default interleaving order, used when the driver does not report a channel map */
+    static const std::array<AudioChannel, 8> DefaultOrder = {
+        {AudioChannel::FrontLeft, AudioChannel::FrontRight, AudioChannel::RearLeft, AudioChannel::RearRight,
+         AudioChannel::FrontCenter, AudioChannel::LFE, AudioChannel::SideLeft, AudioChannel::SideRight}};
+    for (unsigned c = 0; c < chanCount; ++c)
+      chmapOut.m_channels[c] = DefaultOrder[c];
+
+    snd_pcm_chmap_t* chm = snd_pcm_get_chmap(m_pcm);
+    if (!chm)
+      return;
+    if (chm->channels == chanCount) {
+      for (unsigned c = 0; c < chanCount; ++c) {
+        switch (chm->pos[c]) {
+        case SND_CHMAP_FL:
+          chmapOut.m_channels[c] = AudioChannel::FrontLeft;
+          break;
+        case SND_CHMAP_FR:
+          chmapOut.m_channels[c] = AudioChannel::FrontRight;
+          break;
+        case SND_CHMAP_RL:
+          chmapOut.m_channels[c] = AudioChannel::RearLeft;
+          break;
+        case SND_CHMAP_RR:
+          chmapOut.m_channels[c] = AudioChannel::RearRight;
+          break;
+        case SND_CHMAP_FC:
+          chmapOut.m_channels[c] = AudioChannel::FrontCenter;
+          break;
+        case SND_CHMAP_LFE:
+          chmapOut.m_channels[c] = AudioChannel::LFE;
+          break;
+        case SND_CHMAP_SL:
+          chmapOut.m_channels[c] = AudioChannel::SideLeft;
+          break;
+        case SND_CHMAP_SR:
+          chmapOut.m_channels[c] = AudioChannel::SideRight;
+          break;
+        default:
+          chmapOut.m_channels[c] = AudioChannel::Unknown;
+          break;
+        }
+      }
+    }
+    free(chm);
+  }
+
+  void _closePcm() {
+    if (!m_pcm)
+      return;
+    snd_pcm_drop(m_pcm);
+    snd_pcm_close(m_pcm);
+    m_pcm = nullptr;
+  }
+
+  bool _setupPcm() {
+    _closePcm();
+
+    int err;
+    if ((err = snd_pcm_open(&m_pcm, m_deviceName.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK)) < 0) {
+      ALSALog.report(logvisor::Error, FMT_STRING("Unable to snd_pcm_open({}): {}"), m_deviceName, snd_strerror(err));
+      m_pcm = nullptr;
+      return false;
+    }
+
+    snd_pcm_hw_params_t* hwParams;
+    snd_pcm_hw_params_alloca(&hwParams);
+    snd_pcm_hw_params_any(m_pcm, hwParams);
+
+    /* Mapped access is what lets the mixer write into the ring without a bounce buffer */
+    if ((err = snd_pcm_hw_params_set_access(m_pcm, hwParams, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0) {
+      ALSALog.report(logvisor::Error, FMT_STRING("{} does not support mmap access: {}"), m_deviceName,
+                     snd_strerror(err));
+      goto err;
+    }
+
+    if (!snd_pcm_hw_params_set_format(m_pcm, hwParams, SND_PCM_FORMAT_FLOAT)) {
+      m_mixInfo.m_sampleFormat = SOXR_FLOAT32_I;
+      m_mixInfo.m_bitsPerSample = 32;
+    } else if (!snd_pcm_hw_params_set_format(m_pcm, hwParams, SND_PCM_FORMAT_S32)) {
+      m_mixInfo.m_sampleFormat = SOXR_INT32_I;
+      m_mixInfo.m_bitsPerSample = 32;
+    } else if (!snd_pcm_hw_params_set_format(m_pcm, hwParams, SND_PCM_FORMAT_S16)) {
+      m_mixInfo.m_sampleFormat = SOXR_INT16_I;
+      m_mixInfo.m_bitsPerSample = 16;
+    } else {
+      ALSALog.report(logvisor::Error, FMT_STRING("{} supports no float, S32 or S16 format"), m_deviceName);
+      goto err;
+    }
+
+    {
+      unsigned chanCount = _chooseChannelCount(m_pcm, hwParams);
+      if (!chanCount || (err = snd_pcm_hw_params_set_channels(m_pcm, hwParams, chanCount)) < 0) {
+        ALSALog.report(logvisor::Error, FMT_STRING("{} supports no stereo or surround layout"), m_deviceName);
+        goto err;
+      }
+
+      unsigned rate = 48000;
+      if ((err = snd_pcm_hw_params_set_rate_near(m_pcm, hwParams, &rate, nullptr)) < 0) {
+        ALSALog.report(logvisor::Error, FMT_STRING("Unable to set sample rate: {}"), snd_strerror(err));
+        goto err;
+      }
+      m_5msFrames = rate * 5 / 1000;
+
+      /* One device period per 5ms mix quantum where the hardware allows it */
+      snd_pcm_uframes_t periodFrames = m_5msFrames;
+      snd_pcm_uframes_t bufferFrames;
+      if ((err = snd_pcm_hw_params_set_period_size_near(m_pcm, hwParams, &periodFrames, nullptr)) < 0) {
+        ALSALog.report(logvisor::Error, FMT_STRING("Unable to set period size: {}"), snd_strerror(err));
+        goto err;
+      }
+      bufferFrames = periodFrames * ALSABufferPeriods;
+      if ((err = snd_pcm_hw_params_set_buffer_size_near(m_pcm, hwParams, &bufferFrames)) < 0) {
+        ALSALog.report(logvisor::Error, FMT_STRING("Unable to set buffer size: {}"), snd_strerror(err));
+        goto err;
+      }
+
+      if ((err = snd_pcm_hw_params(m_pcm, hwParams)) < 0) {
+        ALSALog.report(logvisor::Error, FMT_STRING("Unable to snd_pcm_hw_params(): {}"), snd_strerror(err));
+        goto err;
+      }
+
+      snd_pcm_sw_params_t* swParams;
+      snd_pcm_sw_params_alloca(&swParams);
+      snd_pcm_sw_params_current(m_pcm, swParams);
+      snd_pcm_sw_params_set_avail_min(m_pcm, swParams, periodFrames);
+      /* Started explicitly once the ring has been filled */
+      snd_pcm_sw_params_set_start_threshold(m_pcm, swParams, bufferFrames + 1);
+      if ((err = snd_pcm_sw_params(m_pcm, swParams)) < 0) {
+        ALSALog.report(logvisor::Error, FMT_STRING("Unable to snd_pcm_sw_params(): {}"), snd_strerror(err));
+        goto err;
+      }
+
+      m_mixInfo.m_sampleRate = rate;
+      m_mixInfo.m_periodFrames = periodFrames;
+      _parseChannelMap(chanCount);
+    }
+
+    _resetSampleRate();
+    return true;
+  err:
+    _closePcm();
+    return false;
+  }
+
+  explicit ALSAAudioVoiceEngine(const char* device) : m_deviceName(device ? device : "default") { _setupPcm(); }
+
+  ~ALSAAudioVoiceEngine() override { _closePcm(); }
+
+  std::vector<std::pair<std::string, std::string>> enumerateAudioOutputs() const override {
+    std::vector<std::pair<std::string, std::string>> ret;
+    void** hints;
+    if (snd_device_name_hint(-1, "pcm", &hints) < 0)
+      return ret;
+
+    for (void** hint = hints; *hint; ++hint) {
+      char* name = snd_device_name_get_hint(*hint, "NAME");
+      char* desc = snd_device_name_get_hint(*hint, "DESC");
+      char* ioid = snd_device_name_get_hint(*hint, "IOID");
+      /* A missing IOID means the device handles both directions */
+      if (name && (!ioid || !strcmp(ioid, "Output"))) {
+        std::string descStr = desc ? desc : name;
+        descStr = descStr.substr(0, descStr.find('\n'));
+        ret.emplace_back(name, std::move(descStr));
+      }
+      free(name);
+      free(desc);
+      free(ioid);
+    }
+
+    snd_device_name_free_hint(hints);
+    return ret;
+  }
+
+  std::string getCurrentAudioOutput() const override { return m_deviceName; }
+
+  bool setCurrentAudioOutput(const char* name) override {
+    std::string oldName = std::move(m_deviceName);
+    m_deviceName = name;
+    if (_setupPcm())
+      return true;
+    m_deviceName = std::move(oldName);
+    _setupPcm();
+    return false;
+  }
+
+  void _pumpAndMixInto(size_t frames, void* dataOut) {
+    switch (m_mixInfo.m_sampleFormat) {
+    case SOXR_INT16_I:
+      _pumpAndMixVoices(frames, static_cast<int16_t*>(dataOut));
+      break;
+    case SOXR_INT32_I:
+      _pumpAndMixVoices(frames, static_cast<int32_t*>(dataOut));
+      break;
+    case SOXR_FLOAT32_I:
+    default:
+      _pumpAndMixVoices(frames, static_cast<float*>(dataOut));
+      break;
+    }
+  }
+
+  /* Returns true if the stream is usable again */
+  bool _recover(int err) {
+    if (err == -EPIPE)
+      _reportUnderrun();
+    if ((err = snd_pcm_recover(m_pcm, err, 1)) < 0) {
+      ALSALog.report(logvisor::Error, FMT_STRING("Unable to recover {}: {}"), m_deviceName, snd_strerror(err));
+      return false;
+    }
+    return true;
+  }
+
+  void pumpAndMixVoices() override {
+    if (!m_pcm) {
+      /* Keep voices advancing in the last negotiated format while no device is open */
+      _pumpAndMixInto(m_5msFrames, nullptr);
+      return;
+    }
+
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(m_pcm);
+    if (avail < 0) {
+      _recover(int(avail));
+      return;
+    }
+
+    snd_pcm_sframes_t delay;
+    if (!snd_pcm_delay(m_pcm, &delay))
+      _setDeviceLatency(delay / m_mixInfo.m_sampleRate);
+
+    snd_pcm_uframes_t periodFrames = m_mixInfo.m_periodFrames;
+    snd_pcm_uframes_t remFrames = snd_pcm_uframes_t(avail) / periodFrames * periodFrames;
+    if (!remFrames)
+      return;
+
+    while (remFrames) {
+      /* The ring may wrap; each mapping covers the contiguous run up to its end */
+      const snd_pcm_channel_area_t* areas;
+      snd_pcm_uframes_t offset;
+      snd_pcm_uframes_t frames = remFrames;
+      int err;
+      if ((err = snd_pcm_mmap_begin(m_pcm, &areas, &offset, &frames)) < 0) {
+        _recover(err);
+        return;
+      }
+
+      uint8_t* dataOut = static_cast<uint8_t*>(areas[0].addr) + (areas[0].first + offset * areas[0].step) / 8;
+      _pumpAndMixInto(frames, dataOut);
+
+      snd_pcm_sframes_t committed = snd_pcm_mmap_commit(m_pcm, offset, frames);
+      if (committed < 0 || snd_pcm_uframes_t(committed) != frames) {
+        _recover(committed < 0 ? int(committed) : -EPIPE);
+        return;
+      }
+      remFrames -= frames;
+    }
+
+    if (snd_pcm_state(m_pcm) == SND_PCM_STATE_PREPARED) {
+      int err;
+      if ((err = snd_pcm_start(m_pcm)) < 0)
+        _recover(err);
+    }
+  }
+};
+
+std::unique_ptr<IAudioVoiceEngine> NewALSAAudioVoiceEngine(const char* device) {
+  auto ret = std::make_unique<ALSAAudioVoiceEngine>(device);
+  if (!ret->m_pcm)
+    return {};
+  return ret;
+}
+
+} // namespace boo
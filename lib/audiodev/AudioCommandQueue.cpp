@@ -0,0 +1,47 @@
+#include "lib/audiodev/AudioCommandQueue.hpp"
+
+namespace boo {
+
+AudioCommandQueue::AudioCommandQueue() : m_slots(new Slot[Capacity]) {
+  for (size_t i = 0; i < Capacity; ++i)
+    m_slots[i].m_seq.store(i, std::memory_order_relaxed);
+}
+
+bool AudioCommandQueue::push(const AudioCommand& cmd) {
+  size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &m_slots[pos & (Capacity - 1)];
+    size_t seq = slot->m_seq.load(std::memory_order_acquire);
+    intptr_t dif = intptr_t(seq) - intptr_t(pos);
+    if (dif == 0) {
+      if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      /* Slot still holds a command from one lap ago */
+      return false;
+    } else {
+      pos = m_enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->m_cmd = cmd;
+  slot->m_seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+AudioCommand* AudioCommandQueue::front() {
+  size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+  Slot& slot = m_slots[pos & (Capacity - 1)];
+  if (slot.m_seq.load(std::memory_order_acquire) != pos + 1)
+    return nullptr;
+  return &slot.m_cmd;
+}
+
+void AudioCommandQueue::pop() {
+  size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+  m_slots[pos & (Capacity - 1)].m_seq.store(pos + Capacity, std::memory_order_release);
+  m_dequeuePos.store(pos + 1, std::memory_order_release);
+}
+
+} // namespace boo
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "boo/audiodev/IAudioVoice.hpp"
+
+namespace boo {
+class AudioSubmix;
+class AudioVoice;
+struct IAudioSubmix;
+
+enum class AudioCommandType : uint8_t {
+  None, /* Cancelled; skipped when drained */
+  VoiceStart,
+  VoiceStop,
+  VoiceResetSampleRate,
+  VoiceResamplerQuality,
+  VoicePitchRatio,
+  VoiceResetChannelLevels,
+  VoiceMonoChannelLevels,
+  VoiceStereoChannelLevels,
+  VoicePriority,
+  SubmixSendLevel,
+  SubmixResetSendLevels,
+  EngineVolume,
+  EngineVoiceBudget,
+  EngineMixQuantum,
+  EngineMixThreads
+};
+
+/** Parameter change posted by a client thread for the pumping thread to apply */
+struct AudioCommand {
+  AudioCommandType m_type = AudioCommandType::None;
+  bool m_slew = false;
+
+  /* Mix quantum at the start of which the command takes effect */
+  size_t m_quantum = 0;
+
+  /* Object the command applies to (neither for engine commands) */
+  AudioVoice* m_voice = nullptr;
+  AudioSubmix* m_submix = nullptr;
+
+  /* Destination submix of level commands */
+  IAudioSubmix* m_send = nullptr;
+
+  union {
+    double m_value;
+    float m_level;
+    int m_priority;
+    size_t m_count;
+    AudioVoiceQuality m_quality;
+    float m_monoCoefs[8];
+    float m_stereoCoefs[8][2];
+  };
+
+  AudioCommand() : m_stereoCoefs{} {}
+  AudioCommand(AudioCommandType type, AudioVoice* voice) : m_type(type), m_voice(voice), m_stereoCoefs{} {}
+  AudioCommand(AudioCommandType type, AudioSubmix* submix) : m_type(type), m_submix(submix), m_stereoCoefs{} {}
+};
+
+/** Bounded multi-producer, single-consumer ring of AudioCommands.
+ *  Producers claim slots with a CAS on the enqueue position and publish them through a per-slot
+ *  sequence number, so neither side ever blocks; the consumer side must be externally serialized. */
+class AudioCommandQueue {
+public:
+  static constexpr size_t Capacity = 1024;
+
+private:
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+  struct Slot {
+    std::atomic_size_t m_seq;
+    AudioCommand m_cmd;
+  };
+
+  std::unique_ptr<Slot[]> m_slots;
+  alignas(64) std::atomic_size_t m_enqueuePos = 0;
+  alignas(64) std::atomic_size_t m_dequeuePos = 0;
+
+public:
+  AudioCommandQueue();
+
+  /** Producer: copy cmd into the ring; returns false when the ring is full */
+  bool push(const AudioCommand& cmd);
+
+  /** Consumer: oldest published command, or nullptr if none is ready */
+  AudioCommand* front();
+
+  /** Consumer: retire the command returned by front() */
+  void pop();
+
+  /** Consumer: visit every published command that has not been popped yet */
+  template <class Fn>
+  void forEachPending(Fn&& fn) {
+    size_t end = m_enqueuePos.load(std::memory_order_acquire);
+    for (size_t pos = m_dequeuePos.load(std::memory_order_relaxed); pos != end; ++pos) {
+      Slot& slot = m_slots[pos & (Capacity - 1)];
+      if (slot.m_seq.load(std::memory_order_acquire) == pos + 1)
+        fn(slot.m_cmd);
+    }
+  }
+
+  /** True if no command has been pushed since the consumer last caught up */
+  bool empty() const {
+    return m_enqueuePos.load(std::memory_order_acquire) == m_dequeuePos.load(std::memory_order_acquire);
+  }
+};
+
+} // namespace boo
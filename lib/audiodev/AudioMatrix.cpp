@@ -21,6 +21,7 @@ void AudioMatrixMono::setDefaultMatrixCoefficients(AudioChannelSet acSet) {
   default:
     break;
   }
+  m_silent = _isSilent(m_coefs);
 }
 
 int16_t* AudioMatrixMono::mixMonoSampleData(const AudioVoiceEngineMixInfo& info, const int16_t* dataIn,
@@ -131,6 +132,7 @@ void AudioMatrixStereo::setDefaultMatrixCoefficients(AudioChannelSet acSet) {
   default:
     break;
   }
+  m_silent = _isSilent(m_coefs);
 }
 
 int16_t* AudioMatrixStereo::mixStereoSampleData(const AudioVoiceEngineMixInfo& info, const int16_t* dataIn,
@@ -144,8 +146,8 @@ int16_t* AudioMatrixStereo::mixStereoSampleData(const AudioVoiceEngineMixInfo& i
       for (unsigned c = 0; c < chmap.m_channelCount; ++c) {
         AudioChannel ch = chmap.m_channels[c];
         if (ch != AudioChannel::Unknown) {
-          *dataOut = Clamp16(*dataOut + *dataIn * (m_coefs.v[int(ch)][0] * t + m_oldCoefs.v[int(ch)][0] * omt) +
-                             *dataIn * (m_coefs.v[int(ch)][1] * t + m_oldCoefs.v[int(ch)][1] * omt));
+          *dataOut = Clamp16(*dataOut + dataIn[0] * (m_coefs.v[int(ch)][0] * t + m_oldCoefs.v[int(ch)][0] * omt) +
+                             dataIn[1] * (m_coefs.v[int(ch)][1] * t + m_oldCoefs.v[int(ch)][1] * omt));
           ++dataOut;
         }
       }
@@ -175,8 +177,8 @@ int32_t* AudioMatrixStereo::mixStereoSampleData(const AudioVoiceEngineMixInfo& i
       for (unsigned c = 0; c < chmap.m_channelCount; ++c) {
         AudioChannel ch = chmap.m_channels[c];
         if (ch != AudioChannel::Unknown) {
-          *dataOut = Clamp32(*dataOut + *dataIn * (m_coefs.v[int(ch)][0] * t + m_oldCoefs.v[int(ch)][0] * omt) +
-                             *dataIn * (m_coefs.v[int(ch)][1] * t + m_oldCoefs.v[int(ch)][1] * omt));
+          *dataOut = Clamp32(*dataOut + dataIn[0] * (m_coefs.v[int(ch)][0] * t + m_oldCoefs.v[int(ch)][0] * omt) +
+                             dataIn[1] * (m_coefs.v[int(ch)][1] * t + m_oldCoefs.v[int(ch)][1] * omt));
           ++dataOut;
         }
       }
@@ -206,8 +208,8 @@ float* AudioMatrixStereo::mixStereoSampleData(const AudioVoiceEngineMixInfo& inf
       for (unsigned c = 0; c < chmap.m_channelCount; ++c) {
         AudioChannel ch = chmap.m_channels[c];
         if (ch != AudioChannel::Unknown) {
-          *dataOut = *dataOut + *dataIn * (m_coefs.v[int(ch)][0] * t + m_oldCoefs.v[int(ch)][0] * omt) +
-                     *dataIn * (m_coefs.v[int(ch)][1] * t + m_oldCoefs.v[int(ch)][1] * omt);
+          *dataOut = *dataOut + dataIn[0] * (m_coefs.v[int(ch)][0] * t + m_oldCoefs.v[int(ch)][0] * omt) +
+                     dataIn[1] * (m_coefs.v[int(ch)][1] * t + m_oldCoefs.v[int(ch)][1] * omt);
           ++dataOut;
         }
       }
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <cfloat>
 #include <climits>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 
@@ -46,6 +48,25 @@ class AudioMatrixMono {
   size_t m_slewFrames = 0;
   size_t m_curSlewFrame = ~size_t(0);
 
+  /* Cached silence of each coefficient set, refreshed whenever coefficients change */
+  bool m_silent = true;
+  bool m_oldSilent = true;
+  static bool _isSilent(const Coefs& coefs) {
+    for (int i = 0; i < 8; ++i)
+      if (coefs.v[i] > FLT_EPSILON)
+        return false;
+    return true;
+  }
+  static float _peak(const Coefs& coefs) {
+    float peak = 0.f;
+    for (int i = 0; i < 8; ++i)
+      peak = std::max(peak, std::fabs(coefs.v[i]));
+    return peak;
+  }
+
+  template <typename T>
+  T* _mixMonoSampleData(const AudioVoiceEngineMixInfo& info, const T* dataIn, T* dataOut, size_t samples);
+
 public:
   AudioMatrixMono() { setDefaultMatrixCoefficients(AudioChannelSet::Stereo); }
 
@@ -56,16 +77,20 @@ public:
     if (m_curSlewFrame != 0) {
       m_oldCoefs.q[0] = m_coefs.q[0];
       m_oldCoefs.q[1] = m_coefs.q[1];
+      m_oldSilent = m_silent;
     }
     m_coefs.q[0] = _mm_loadu_ps(coefs);
     m_coefs.q[1] = _mm_loadu_ps(&coefs[4]);
 #else
+    if (m_curSlewFrame != 0)
+      m_oldSilent = m_silent;
     for (int i = 0; i < 8; ++i) {
       if (m_curSlewFrame != 0)
         m_oldCoefs.v[i] = m_coefs.v[i];
       m_coefs.v[i] = coefs[i];
     }
 #endif
+    m_silent = _isSilent(m_coefs);
     m_curSlewFrame = 0;
   }
 
@@ -75,15 +100,11 @@ public:
                              size_t samples);
   float* mixMonoSampleData(const AudioVoiceEngineMixInfo& info, const float* dataIn, float* dataOut, size_t samples);
 
-  bool isSilent() const {
-    if (m_curSlewFrame < m_slewFrames)
-      for (int i = 0; i < 8; ++i)
-        if (m_oldCoefs.v[i] > FLT_EPSILON)
-          return false;
-    for (int i = 0; i < 8; ++i)
-      if (m_coefs.v[i] > FLT_EPSILON)
-        return false;
-    return true;
+  bool isSilent() const { return m_silent && (m_oldSilent || m_curSlewFrame >= m_slewFrames); }
+
+  /* Largest gain into any output channel, including coefficients still being slewed away from */
+  float peakCoefficient() const {
+    return m_curSlewFrame < m_slewFrames ? std::max(_peak(m_coefs), _peak(m_oldCoefs)) : _peak(m_coefs);
   }
 };
 
@@ -100,6 +121,25 @@ class AudioMatrixStereo {
   size_t m_slewFrames = 0;
   size_t m_curSlewFrame = ~size_t(0);
 
+  /* Cached silence of each coefficient set, refreshed whenever coefficients change */
+  bool m_silent = true;
+  bool m_oldSilent = true;
+  static bool _isSilent(const Coefs& coefs) {
+    for (int i = 0; i < 8; ++i)
+      if (coefs.v[i][0] > FLT_EPSILON || coefs.v[i][1] > FLT_EPSILON)
+        return false;
+    return true;
+  }
+  static float _peak(const Coefs& coefs) {
+    float peak = 0.f;
+    for (int i = 0; i < 8; ++i)
+      peak = std::max({peak, std::fabs(coefs.v[i][0]), std::fabs(coefs.v[i][1])});
+    return peak;
+  }
+
+  template <typename T>
+  T* _mixStereoSampleData(const AudioVoiceEngineMixInfo& info, const T* dataIn, T* dataOut, size_t frames);
+
 public:
   AudioMatrixStereo() { setDefaultMatrixCoefficients(AudioChannelSet::Stereo); }
 
@@ -112,12 +152,15 @@ public:
       m_oldCoefs.q[1] = m_coefs.q[1];
       m_oldCoefs.q[2] = m_coefs.q[2];
       m_oldCoefs.q[3] = m_coefs.q[3];
+      m_oldSilent = m_silent;
     }
     m_coefs.q[0] = _mm_loadu_ps(coefs[0]);
     m_coefs.q[1] = _mm_loadu_ps(coefs[2]);
     m_coefs.q[2] = _mm_loadu_ps(coefs[4]);
     m_coefs.q[3] = _mm_loadu_ps(coefs[6]);
 #else
+    if (m_curSlewFrame != 0)
+      m_oldSilent = m_silent;
     for (int i = 0; i < 8; ++i) {
       if (m_curSlewFrame != 0) {
         m_oldCoefs.v[i][0] = m_coefs.v[i][0];
@@ -127,6 +170,7 @@ public:
       m_coefs.v[i][1] = coefs[i][1];
     }
 #endif
+    m_silent = _isSilent(m_coefs);
     m_curSlewFrame = 0;
   }
 
@@ -136,15 +180,11 @@ public:
                                size_t frames);
   float* mixStereoSampleData(const AudioVoiceEngineMixInfo& info, const float* dataIn, float* dataOut, size_t frames);
 
-  bool isSilent() const {
-    if (m_curSlewFrame < m_slewFrames)
-      for (int i = 0; i < 8; ++i)
-        if (m_oldCoefs.v[i][0] > FLT_EPSILON || m_oldCoefs.v[i][1] > FLT_EPSILON)
-          return false;
-    for (int i = 0; i < 8; ++i)
-      if (m_coefs.v[i][0] > FLT_EPSILON || m_coefs.v[i][1] > FLT_EPSILON)
-        return false;
-    return true;
+  bool isSilent() const { return m_silent && (m_oldSilent || m_curSlewFrame >= m_slewFrames); }
+
+  /* Largest gain into any output channel, including coefficients still being slewed away from */
+  float peakCoefficient() const {
+    return m_curSlewFrame < m_slewFrames ? std::max(_peak(m_coefs), _peak(m_oldCoefs)) : _peak(m_coefs);
   }
 };
 
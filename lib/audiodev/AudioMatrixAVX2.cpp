@@ -0,0 +1,97 @@
+#include "lib/audiodev/AudioMatrixKernels.hpp"
+
+#include <cstring>
+
+#include <immintrin.h>
+
+namespace boo {
+
+namespace {
+
+/* Only reached after a runtime check for AVX2 and FMA; see GetAudioMatrixKernels */
+struct AVX2MixOps {
+  using F = __m256;
+  static constexpr int W = 8;
+
+  static F set1(float v) { return _mm256_set1_ps(v); }
+  static F add(F a, F b) { return _mm256_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+  static F min(F a, F b) { return _mm256_min_ps(a, b); }
+  static F madd(F a, F b, F c) { return _mm256_fmadd_ps(a, b, c); }
+  static F load(const float* p) { return _mm256_loadu_ps(p); }
+
+  static F widen16(__m128i v) { return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)); }
+
+  template <int N>
+  static F loadIn(const int16_t* p) {
+    if constexpr (N == 8) {
+      return widen16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    } else if constexpr (N == 4) {
+      return widen16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    } else if constexpr (N == 2) {
+      int32_t pair;
+      memcpy(&pair, p, sizeof(pair));
+      return widen16(_mm_cvtsi32_si128(pair));
+    } else {
+      return _mm256_set1_ps(p[0]);
+    }
+  }
+  template <int N>
+  static F loadIn(const int32_t* p) {
+    if constexpr (N == 8)
+      return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    else if constexpr (N == 4)
+      return _mm256_castps128_ps256(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+    else if constexpr (N == 2)
+      return _mm256_castps128_ps256(_mm_cvtepi32_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+    else
+      return _mm256_set1_ps(float(p[0]));
+  }
+  template <int N>
+  static F loadIn(const float* p) {
+    if constexpr (N == 8)
+      return _mm256_loadu_ps(p);
+    else if constexpr (N == 4)
+      return _mm256_castps128_ps256(_mm_loadu_ps(p));
+    else if constexpr (N == 2)
+      return _mm256_castps128_ps256(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(p))));
+    else
+      return _mm256_set1_ps(p[0]);
+  }
+
+  static F loadOut(const int16_t* p) { return widen16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+  static F loadOut(const int32_t* p) {
+    return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+  }
+  static F loadOut(const float* p) { return _mm256_loadu_ps(p); }
+  static void storeOut(int16_t* p, F v) {
+    __m256i i =
+        _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(SHRT_MIN)), _mm256_set1_ps(SHRT_MAX)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+                     _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1)));
+  }
+  static void storeOut(int32_t* p, F v) {
+    /* Upper bound is the largest float below 2^31, which converts without overflow */
+    __m256i i =
+        _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(INT_MIN)), _mm256_set1_ps(2147483520.f)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), i);
+  }
+  static void storeOut(float* p, F v) { _mm256_storeu_ps(p, v); }
+
+  template <class Pattern>
+  static F pick(F v) {
+    return _mm256_permutevar8x32_ps(
+        v, _mm256_setr_epi32(Pattern::idx(0), Pattern::idx(0), Pattern::idx(1), Pattern::idx(1), Pattern::idx(2),
+                             Pattern::idx(2), Pattern::idx(3), Pattern::idx(3)));
+  }
+};
+
+} // Anonymous namespace
+
+const AudioMatrixKernels& GetAVX2AudioMatrixKernels() {
+  static const AudioMatrixKernels Kernels = MakeAudioMatrixKernels<AVX2MixOps>();
+  return Kernels;
+}
+
+} // namespace boo
@@ -0,0 +1,173 @@
+#include "lib/audiodev/AudioMatrixKernels.hpp"
+
+#include <climits>
+#include <cstring>
+
+#if _MSC_VER && (defined(__x86_64__) || defined(_M_AMD64))
+#include <intrin.h>
+#endif
+
+namespace boo {
+
+namespace {
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+/* NEON is baseline on arm64; saturating conversions clip integer formats */
+struct BaseMixOps {
+  using F = float32x4_t;
+  static constexpr int W = 4;
+
+  static F set1(float v) { return vdupq_n_f32(v); }
+  static F add(F a, F b) { return vaddq_f32(a, b); }
+  static F sub(F a, F b) { return vsubq_f32(a, b); }
+  static F mul(F a, F b) { return vmulq_f32(a, b); }
+  static F min(F a, F b) { return vminq_f32(a, b); }
+  static F madd(F a, F b, F c) { return vfmaq_f32(c, a, b); }
+  static F load(const float* p) { return vld1q_f32(p); }
+
+  template <int N, typename T>
+  static F loadInPartial(const T* p) {
+    F v = vdupq_n_f32(float(p[0]));
+    if constexpr (N == 2)
+      v = vsetq_lane_f32(float(p[1]), v, 1);
+    return v;
+  }
+  template <int N>
+  static F loadIn(const int16_t* p) {
+    if constexpr (N == 4)
+      return vcvtq_f32_s32(vmovl_s16(vld1_s16(p)));
+    else
+      return loadInPartial<N>(p);
+  }
+  template <int N>
+  static F loadIn(const int32_t* p) {
+    if constexpr (N == 4)
+      return vcvtq_f32_s32(vld1q_s32(p));
+    else
+      return loadInPartial<N>(p);
+  }
+  template <int N>
+  static F loadIn(const float* p) {
+    if constexpr (N == 4)
+      return vld1q_f32(p);
+    else
+      return loadInPartial<N>(p);
+  }
+
+  static F loadOut(const int16_t* p) { return vcvtq_f32_s32(vmovl_s16(vld1_s16(p))); }
+  static F loadOut(const int32_t* p) { return vcvtq_f32_s32(vld1q_s32(p)); }
+  static F loadOut(const float* p) { return vld1q_f32(p); }
+  static void storeOut(int16_t* p, F v) { vst1_s16(p, vqmovn_s32(vcvtq_s32_f32(v))); }
+  static void storeOut(int32_t* p, F v) { vst1q_s32(p, vcvtq_s32_f32(v)); }
+  static void storeOut(float* p, F v) { vst1q_f32(p, v); }
+
+  template <class Pattern>
+  static F pick(F v) {
+    return vcombine_f32(vdup_laneq_f32(v, Pattern::idx(0)), vdup_laneq_f32(v, Pattern::idx(1)));
+  }
+};
+#else
+struct BaseMixOps {
+  using F = __m128;
+  static constexpr int W = 4;
+
+  static F set1(float v) { return _mm_set1_ps(v); }
+  static F add(F a, F b) { return _mm_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+  static F min(F a, F b) { return _mm_min_ps(a, b); }
+  static F madd(F a, F b, F c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+  static F load(const float* p) { return _mm_loadu_ps(p); }
+
+  static F widen16(__m128i v) { return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)); }
+
+  template <int N>
+  static F loadIn(const int16_t* p) {
+    if constexpr (N == 4) {
+      return widen16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    } else if constexpr (N == 2) {
+      int32_t pair;
+      memcpy(&pair, p, sizeof(pair));
+      return widen16(_mm_cvtsi32_si128(pair));
+    } else {
+      return _mm_set1_ps(p[0]);
+    }
+  }
+  template <int N>
+  static F loadIn(const int32_t* p) {
+    if constexpr (N == 4)
+      return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    else if constexpr (N == 2)
+      return _mm_cvtepi32_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    else
+      return _mm_set1_ps(float(p[0]));
+  }
+  template <int N>
+  static F loadIn(const float* p) {
+    if constexpr (N == 4)
+      return _mm_loadu_ps(p);
+    else if constexpr (N == 2)
+      return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(p)));
+    else
+      return _mm_set1_ps(p[0]);
+  }
+
+  static F loadOut(const int16_t* p) { return widen16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))); }
+  static F loadOut(const int32_t* p) { return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+  static F loadOut(const float* p) { return _mm_loadu_ps(p); }
+  static void storeOut(int16_t* p, F v) {
+    __m128i i = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, _mm_set1_ps(SHRT_MIN)), _mm_set1_ps(SHRT_MAX)));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(i, i));
+  }
+  static void storeOut(int32_t* p, F v) {
+    /* Upper bound is the largest float below 2^31, which converts without overflow */
+    __m128i i = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, _mm_set1_ps(INT_MIN)), _mm_set1_ps(2147483520.f)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), i);
+  }
+  static void storeOut(float* p, F v) { _mm_storeu_ps(p, v); }
+
+  template <class Pattern>
+  static F pick(F v) {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(Pattern::idx(1), Pattern::idx(1), Pattern::idx(0), Pattern::idx(0)));
+  }
+};
+#endif
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+bool CPUSupportsAVX2() {
+#if _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  const bool fma = info[2] & (1 << 12);
+  const bool osxsave = info[2] & (1 << 27);
+  if (!fma || !osxsave || (_xgetbv(0) & 0x6) != 0x6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return info[1] & (1 << 5);
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+} // Anonymous namespace
+
+const AudioMatrixKernels& GetBaseAudioMatrixKernels() {
+  static const AudioMatrixKernels Kernels = MakeAudioMatrixKernels<BaseMixOps>();
+  return Kernels;
+}
+
+const AudioMatrixKernels& GetAudioMatrixKernels() {
+#if defined(__x86_64__) || defined(_M_AMD64)
+  static const bool UseAVX2 = CPUSupportsAVX2();
+  if (UseAVX2)
+    return GetAVX2AudioMatrixKernels();
+#endif
+  return GetBaseAudioMatrixKernels();
+}
+
+} // namespace boo
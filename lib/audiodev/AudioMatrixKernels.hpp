@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+
+#include "lib/audiodev/AudioMatrix.hpp"
+
+namespace boo {
+
+/** Matrix coefficients resolved to the interleaved destination channel order */
+struct AudioMatrixParams {
+  float m_coefs[8][2];
+  float m_oldCoefs[8][2];
+  size_t m_slewFrames;
+};
+
+template <typename T>
+using AudioMatrixMixFn = T* (*)(const AudioMatrixParams& params, const T* dataIn, T* dataOut, size_t frames,
+                                size_t& curSlewFrame);
+
+/** Mono and stereo mixing kernels of one instruction set for 2, 4, 6 and 8 destination channels */
+struct AudioMatrixKernels {
+  AudioMatrixMixFn<int16_t> m_mono16[4];
+  AudioMatrixMixFn<int32_t> m_mono32[4];
+  AudioMatrixMixFn<float> m_monoFlt[4];
+  AudioMatrixMixFn<int16_t> m_stereo16[4];
+  AudioMatrixMixFn<int32_t> m_stereo32[4];
+  AudioMatrixMixFn<float> m_stereoFlt[4];
+
+  template <typename T>
+  const AudioMatrixMixFn<T>* mono() const;
+  template <typename T>
+  const AudioMatrixMixFn<T>* stereo() const;
+};
+
+template <>
+inline const AudioMatrixMixFn<int16_t>* AudioMatrixKernels::mono<int16_t>() const {
+  return m_mono16;
+}
+template <>
+inline const AudioMatrixMixFn<int32_t>* AudioMatrixKernels::mono<int32_t>() const {
+  return m_mono32;
+}
+template <>
+inline const AudioMatrixMixFn<float>* AudioMatrixKernels::mono<float>() const {
+  return m_monoFlt;
+}
+
+template <>
+inline const AudioMatrixMixFn<int16_t>* AudioMatrixKernels::stereo<int16_t>() const {
+  return m_stereo16;
+}
+template <>
+inline const AudioMatrixMixFn<int32_t>* AudioMatrixKernels::stereo<int32_t>() const {
+  return m_stereo32;
+}
+template <>
+inline const AudioMatrixMixFn<float>* AudioMatrixKernels::stereo<float>() const {
+  return m_stereoFlt;
+}
+
+/* Kernel slot for a destination channel count, or -1 if no kernel handles it */
+static inline int AudioMatrixKernelSlot(unsigned chanCount) {
+  switch (chanCount) {
+  case 2:
+    return 0;
+  case 4:
+    return 1;
+  case 6:
+    return 2;
+  case 8:
+    return 3;
+  default:
+    return -1;
+  }
+}
+
+/* Defined in AudioMatrixBase.cpp: SSE2 on x86-64, NEON on arm64 */
+const AudioMatrixKernels& GetBaseAudioMatrixKernels();
+
+/* Widest kernels the running CPU supports */
+const AudioMatrixKernels& GetAudioMatrixKernels();
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+/* Defined in AudioMatrixAVX2.cpp, which is built with AVX2 and FMA enabled */
+const AudioMatrixKernels& GetAVX2AudioMatrixKernels();
+#endif
+
+/*
+ * The kernel templates below are instantiated once per instruction set, each in its own
+ * translation unit and with its own compiler flags; internal linkage keeps the linker from
+ * folding an AVX2 instantiation into a baseline caller.
+ *
+ * Instruction set policies (V) provide a float vector F of W lanes and:
+ *   set1, add, sub, mul, min, madd(a, b, c) = a * b + c
+ *   load(const float*)              - W floats
+ *   loadIn<N>(const T*)             - N <= W source samples into the low lanes
+ *   loadOut(const T*) / storeOut()  - W destination samples, clipping integer formats
+ *   pick<Pattern>(F)                - lanes (2j, 2j+1) both take lane Pattern::idx(j) of the source
+ */
+namespace {
+
+template <typename T>
+inline T ClampMixSample(float in) {
+  if constexpr (std::is_same_v<T, int16_t>)
+    return Clamp16(in);
+  else if constexpr (std::is_same_v<T, int32_t>)
+    return Clamp32(in);
+  else
+    return in;
+}
+
+/* Frame (Side < 0) or stereo source lane (Side 0/1) feeding lane pair j of vector K within a period.
+ * Destination channel counts are even, so both lanes of a pair always belong to the same frame. */
+template <int C, int W, int K, int Side>
+struct MixPattern {
+  static constexpr int idx(int j) {
+    int frame = (K * W + 2 * j) / C;
+    return Side < 0 ? frame : frame * 2 + Side;
+  }
+};
+
+template <int N, class Fn, int... Ks>
+inline void UnrollImpl(Fn&& fn, std::integer_sequence<int, Ks...>) {
+  (fn(std::integral_constant<int, Ks>{}), ...);
+}
+
+template <int N, class Fn>
+inline void Unroll(Fn&& fn) {
+  UnrollImpl<N>(fn, std::make_integer_sequence<int, N>{});
+}
+
+template <class V, int C, typename T, bool Stereo>
+T* MixKernel(const AudioMatrixParams& params, const T* dataIn, T* dataOut, size_t frames, size_t& curSlewFrame) {
+  using F = typename V::F;
+  constexpr int W = V::W;
+  constexpr int P = std::lcm(C, W) / C; /* Frames per period of whole vectors */
+  constexpr int K = P * C / W;          /* Vectors per period */
+  constexpr int InStride = Stereo ? 2 : 1;
+
+  /* Gains laid out as they repeat over one period */
+  alignas(32) float coefsL[K * W], coefsR[K * W], oldL[K * W], oldR[K * W], frameIdx[K * W];
+  for (int s = 0; s < K * W; ++s) {
+    coefsL[s] = params.m_coefs[s % C][0];
+    coefsR[s] = params.m_coefs[s % C][1];
+    oldL[s] = params.m_oldCoefs[s % C][0];
+    oldR[s] = params.m_oldCoefs[s % C][1];
+    frameIdx[s] = float(s / C);
+  }
+
+  size_t f = 0;
+  if (params.m_slewFrames && curSlewFrame < params.m_slewFrames) {
+    /* Ramp gains linearly from old to new coefficients: old + (new - old) * min(frame / slewFrames, 1) */
+    size_t slewEnd = std::min(frames, params.m_slewFrames - curSlewFrame);
+    const F invSlew = V::set1(1.f / float(params.m_slewFrames));
+    const F one = V::set1(1.f);
+    const F periodAdvance = V::set1(float(P));
+    F baseL[K], deltaL[K], baseR[K], deltaR[K], frameVec[K];
+    for (int k = 0; k < K; ++k) {
+      baseL[k] = V::load(oldL + k * W);
+      deltaL[k] = V::sub(V::load(coefsL + k * W), baseL[k]);
+      baseR[k] = V::load(oldR + k * W);
+      deltaR[k] = V::sub(V::load(coefsR + k * W), baseR[k]);
+      frameVec[k] = V::add(V::load(frameIdx + k * W), V::set1(float(curSlewFrame)));
+    }
+
+    for (; f + P <= slewEnd; f += P, dataIn += P * InStride, dataOut += P * C) {
+      F in = V::template loadIn<P * InStride>(dataIn);
+      Unroll<K>([&](auto kc) {
+        constexpr int k = decltype(kc)::value;
+        F t = V::min(V::mul(frameVec[k], invSlew), one);
+        F out = V::loadOut(dataOut + k * W);
+        if constexpr (Stereo) {
+          out = V::madd(V::template pick<MixPattern<C, W, k, 0>>(in), V::madd(deltaL[k], t, baseL[k]), out);
+          out = V::madd(V::template pick<MixPattern<C, W, k, 1>>(in), V::madd(deltaR[k], t, baseR[k]), out);
+        } else {
+          out = V::madd(V::template pick<MixPattern<C, W, k, -1>>(in), V::madd(deltaL[k], t, baseL[k]), out);
+        }
+        V::storeOut(dataOut + k * W, out);
+        frameVec[k] = V::add(frameVec[k], periodAdvance);
+      });
+    }
+
+    for (; f < slewEnd; ++f, dataIn += InStride) {
+      float t = float(curSlewFrame + f) / float(params.m_slewFrames);
+      for (int c = 0; c < C; ++c, ++dataOut) {
+        float mix = *dataOut + dataIn[0] * (oldL[c] + (coefsL[c] - oldL[c]) * t);
+        if constexpr (Stereo)
+          mix += dataIn[1] * (oldR[c] + (coefsR[c] - oldR[c]) * t);
+        *dataOut = ClampMixSample<T>(mix);
+      }
+    }
+
+    curSlewFrame += slewEnd;
+  }
+
+  F gainL[K], gainR[K];
+  for (int k = 0; k < K; ++k) {
+    gainL[k] = V::load(coefsL + k * W);
+    gainR[k] = V::load(coefsR + k * W);
+  }
+
+  for (; f + P <= frames; f += P, dataIn += P * InStride, dataOut += P * C) {
+    F in = V::template loadIn<P * InStride>(dataIn);
+    Unroll<K>([&](auto kc) {
+      constexpr int k = decltype(kc)::value;
+      F out = V::loadOut(dataOut + k * W);
+      if constexpr (Stereo) {
+        out = V::madd(V::template pick<MixPattern<C, W, k, 0>>(in), gainL[k], out);
+        out = V::madd(V::template pick<MixPattern<C, W, k, 1>>(in), gainR[k], out);
+      } else {
+        out = V::madd(V::template pick<MixPattern<C, W, k, -1>>(in), gainL[k], out);
+      }
+      V::storeOut(dataOut + k * W, out);
+    });
+  }
+
+  for (; f < frames; ++f, dataIn += InStride) {
+    for (int c = 0; c < C; ++c, ++dataOut) {
+      float mix = *dataOut + dataIn[0] * coefsL[c];
+      if constexpr (Stereo)
+        mix += dataIn[1] * coefsR[c];
+      *dataOut = ClampMixSample<T>(mix);
+    }
+  }
+
+  return dataOut;
+}
+
+template <class V>
+AudioMatrixKernels MakeAudioMatrixKernels() {
+  return {
+      {MixKernel<V, 2, int16_t, false>, MixKernel<V, 4, int16_t, false>, MixKernel<V, 6, int16_t, false>,
+       MixKernel<V, 8, int16_t, false>},
+      {MixKernel<V, 2, int32_t, false>, MixKernel<V, 4, int32_t, false>, MixKernel<V, 6, int32_t, false>,
+       MixKernel<V, 8, int32_t, false>},
+      {MixKernel<V, 2, float, false>, MixKernel<V, 4, float, false>, MixKernel<V, 6, float, false>,
+       MixKernel<V, 8, float, false>},
+      {MixKernel<V, 2, int16_t, true>, MixKernel<V, 4, int16_t, true>, MixKernel<V, 6, int16_t, true>,
+       MixKernel<V, 8, int16_t, true>},
+      {MixKernel<V, 2, int32_t, true>, MixKernel<V, 4, int32_t, true>, MixKernel<V, 6, int32_t, true>,
+       MixKernel<V, 8, int32_t, true>},
+      {MixKernel<V, 2, float, true>, MixKernel<V, 4, float, true>, MixKernel<V, 6, float, true>,
+       MixKernel<V, 8, float, true>},
+  };
+}
+
+} // Anonymous namespace
+
+} // namespace boo
@@ -0,0 +1,128 @@
+#include "lib/audiodev/AudioPanning.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define __SSE__ 1
+#include "sse2neon.h"
+#endif
+
+namespace boo {
+
+/* Horizontal unit direction (x right, z ahead) of each AudioChannel's speaker per ITU-R BS.775 */
+static constexpr float SpeakerDirs[8][2] = {
+    {-0.5f, 0.8660254f},        /* FrontLeft, -30 degrees */
+    {0.5f, 0.8660254f},         /* FrontRight, +30 degrees */
+    {-0.9396926f, -0.3420201f}, /* RearLeft, -110 degrees */
+    {0.9396926f, -0.3420201f},  /* RearRight, +110 degrees */
+    {0.f, 1.f},                 /* FrontCenter */
+    {0.f, 0.f},                 /* LFE, never panned */
+    {-1.f, 0.f},                /* SideLeft, -90 degrees */
+    {1.f, 0.f},                 /* SideRight, +90 degrees */
+};
+
+/* Avoids dividing by zero for sources at the listener, which spread evenly */
+static constexpr float MinLengthSquared = 1e-12f;
+
+/* Sources opposite a narrow layout (behind a stereo pair) keep minute gains that still normalize */
+static constexpr float MinPower = 1e-36f;
+
+void ComputePanGains(const ChannelMap& chMap, AudioPanBatch& batch) {
+  bool present[8] = {};
+  for (unsigned c = 0; c < chMap.m_channelCount; ++c)
+    if (chMap.m_channels[c] != AudioChannel::Unknown && chMap.m_channels[c] != AudioChannel::LFE)
+      present[int(chMap.m_channels[c])] = true;
+  for (int c = 0; c < 8; ++c)
+    if (!present[c])
+      std::fill(std::begin(batch.m_gains[c]), std::end(batch.m_gains[c]), 0.f);
+
+  size_t s = 0;
+#if __SSE__
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 minLen = _mm_set1_ps(MinLengthSquared);
+  const __m128 minPower = _mm_set1_ps(MinPower);
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  for (; s + 4 <= batch.m_count; s += 4) {
+    __m128 x = _mm_load_ps(batch.m_x + s);
+    __m128 y = _mm_load_ps(batch.m_y + s);
+    __m128 z = _mm_load_ps(batch.m_z + s);
+    __m128 horiz = _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(z, z));
+    __m128 total = _mm_add_ps(horiz, _mm_mul_ps(y, y));
+
+    /* A direction straight up or down (or at the listener) has no bearing and spreads evenly */
+    __m128 invHoriz = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(horiz, minLen)));
+    __m128 hasBearing = _mm_cmpgt_ps(horiz, minLen);
+    x = _mm_and_ps(_mm_mul_ps(x, invHoriz), hasBearing);
+    z = _mm_and_ps(_mm_mul_ps(z, invHoriz), hasBearing);
+    __m128 elevation = _mm_div_ps(_mm_and_ps(y, absMask), _mm_sqrt_ps(_mm_max_ps(total, minLen)));
+    __m128 spread = _mm_max_ps(_mm_load_ps(batch.m_spread + s), elevation);
+    spread = _mm_or_ps(_mm_and_ps(hasBearing, spread), _mm_andnot_ps(hasBearing, one));
+    spread = _mm_min_ps(_mm_max_ps(spread, zero), one);
+    __m128 focus = _mm_sub_ps(one, spread);
+
+    __m128 power = zero;
+    for (int c = 0; c < 8; ++c) {
+      if (!present[c])
+        continue;
+      __m128 g = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(SpeakerDirs[c][0])),
+                            _mm_mul_ps(z, _mm_set1_ps(SpeakerDirs[c][1])));
+      g = _mm_mul_ps(_mm_add_ps(g, one), half);
+      g = _mm_mul_ps(g, g);
+      g = _mm_mul_ps(g, g);
+      g = _mm_mul_ps(g, g);
+      g = _mm_add_ps(_mm_mul_ps(g, focus), spread);
+      power = _mm_add_ps(power, _mm_mul_ps(g, g));
+      _mm_store_ps(batch.m_gains[c] + s, g);
+    }
+
+    __m128 norm = _mm_div_ps(_mm_load_ps(batch.m_gain + s), _mm_sqrt_ps(_mm_max_ps(power, minPower)));
+    for (int c = 0; c < 8; ++c)
+      if (present[c])
+        _mm_store_ps(batch.m_gains[c] + s, _mm_mul_ps(_mm_load_ps(batch.m_gains[c] + s), norm));
+  }
+#endif
+  for (; s < batch.m_count; ++s) {
+    float x = batch.m_x[s];
+    float y = batch.m_y[s];
+    float z = batch.m_z[s];
+    float horiz = x * x + z * z;
+    float total = horiz + y * y;
+
+    float spread = 1.f;
+    if (horiz > MinLengthSquared) {
+      float invHoriz = 1.f / std::sqrt(horiz);
+      x *= invHoriz;
+      z *= invHoriz;
+      spread = std::clamp(std::max(batch.m_spread[s], std::fabs(y) / std::sqrt(total)), 0.f, 1.f);
+    } else {
+      x = 0.f;
+      z = 0.f;
+    }
+    float focus = 1.f - spread;
+
+    float power = 0.f;
+    for (int c = 0; c < 8; ++c) {
+      if (!present[c])
+        continue;
+      float g = (x * SpeakerDirs[c][0] + z * SpeakerDirs[c][1] + 1.f) * 0.5f;
+      g *= g;
+      g *= g;
+      g *= g;
+      g = g * focus + spread;
+      power += g * g;
+      batch.m_gains[c][s] = g;
+    }
+
+    float norm = batch.m_gain[s] / std::sqrt(std::max(power, MinPower));
+    for (int c = 0; c < 8; ++c)
+      if (present[c])
+        batch.m_gains[c][s] *= norm;
+  }
+}
+
+} // namespace boo
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+#include "boo/audiodev/IAudioVoice.hpp"
+
+namespace boo {
+
+/** Structure-of-arrays batch of source positions, panned four at a time by ComputePanGains */
+struct AudioPanBatch {
+  static constexpr size_t Capacity = 64;
+  static_assert(Capacity % 4 == 0, "Capacity must fill whole vectors");
+
+  size_t m_count = 0;
+  alignas(16) float m_x[Capacity];
+  alignas(16) float m_y[Capacity];
+  alignas(16) float m_z[Capacity];
+  alignas(16) float m_spread[Capacity];
+  alignas(16) float m_gain[Capacity];
+
+  /* Output gains indexed by AudioChannel, then by source */
+  alignas(16) float m_gains[8][Capacity];
+
+  void add(float x, float y, float z, float spread, float gain) {
+    m_x[m_count] = x;
+    m_y[m_count] = y;
+    m_z[m_count] = z;
+    m_spread[m_count] = spread;
+    m_gain[m_count] = gain;
+    ++m_count;
+  }
+
+  /* Left then right channel of a stereo source, turned to either side of its direction by width */
+  void addStereo(const float position[3], float width, float spread, float gain) {
+    const float x = position[0];
+    const float y = position[1];
+    const float z = position[2];
+    add(x - width * z, y, z + width * x, spread, gain);
+    add(x + width * z, y, z - width * x, spread, gain);
+  }
+};
+
+/* Constant-power gains of every speaker in chMap for each source of batch (LFE and absent channels get 0).
+ * Each speaker is weighted by ((1 + cos angle) / 2)^8 between it and the source direction on the horizontal
+ * plane, blended towards even power by the source's spread (or its elevation, whichever is larger). */
+void ComputePanGains(const ChannelMap& chMap, AudioPanBatch& batch);
+
+} // namespace boo
@@ -0,0 +1,127 @@
+#include "lib/audiodev/AudioQuantize.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define __SSE__ 1
+#include "sse2neon.h"
+#endif
+
+namespace boo {
+
+/* Largest representable value strictly below scale; 2^31 - 1 is not representable as a float */
+static float ClipHigh(float scale) { return std::min(scale - 1.f, std::nextafter(scale, 0.f)); }
+
+#if __SSE__
+static inline __m128 DitherUnit(__m128i& seeds) {
+  seeds = _mm_xor_si128(seeds, _mm_slli_epi32(seeds, 13));
+  seeds = _mm_xor_si128(seeds, _mm_srli_epi32(seeds, 17));
+  seeds = _mm_xor_si128(seeds, _mm_slli_epi32(seeds, 5));
+  __m128i bits = _mm_or_si128(_mm_srli_epi32(seeds, 9), _mm_set1_epi32(0x3f800000));
+  return _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.f));
+}
+
+static inline __m128 DitherTPDF(__m128i& seeds) {
+  __m128 a = DitherUnit(seeds);
+  return _mm_sub_ps(a, DitherUnit(seeds));
+}
+
+/* Scale, optionally dither and clip four samples to the integer range [-scale, high] */
+static inline __m128i QuantizeVec(const float* in, __m128 mul, __m128 low, __m128 high, __m128i* seeds) {
+  __m128 v = _mm_mul_ps(_mm_loadu_ps(in), mul);
+  if (seeds)
+    v = _mm_add_ps(v, DitherTPDF(*seeds));
+  v = _mm_min_ps(_mm_max_ps(v, low), high);
+  return _mm_cvtps_epi32(v);
+}
+#endif
+
+static inline int32_t Quantize(float in, float mul, float scale, float high, DitherState* dither) {
+  float v = in * mul;
+  if (dither)
+    v += dither->next();
+  return int32_t(std::lrint(std::clamp(v, -scale, high)));
+}
+
+void ConvertToInt16(const float* in, int16_t* out, size_t samples, float gain, DitherState* dither) {
+  constexpr float Scale = 32768.f;
+  const float mul = gain * Scale;
+  const float high = ClipHigh(Scale);
+  size_t s = 0;
+  if (dither)
+    dither->m_lane = 0;
+#if __SSE__
+  const __m128 mulVec = _mm_set1_ps(mul);
+  const __m128 lowVec = _mm_set1_ps(-Scale);
+  const __m128 highVec = _mm_set1_ps(high);
+  __m128i seeds = _mm_setzero_si128();
+  if (dither)
+    seeds = _mm_load_si128(reinterpret_cast<const __m128i*>(dither->m_seeds));
+  __m128i* seedsPtr = dither ? &seeds : nullptr;
+  for (; s + 8 <= samples; s += 8) {
+    __m128i lo = QuantizeVec(in + s, mulVec, lowVec, highVec, seedsPtr);
+    __m128i hi = QuantizeVec(in + s + 4, mulVec, lowVec, highVec, seedsPtr);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + s), _mm_packs_epi32(lo, hi));
+  }
+  if (dither)
+    _mm_store_si128(reinterpret_cast<__m128i*>(dither->m_seeds), seeds);
+#endif
+  for (; s < samples; ++s)
+    out[s] = int16_t(Quantize(in[s], mul, Scale, high, dither));
+}
+
+void ConvertToInt32(const float* in, int32_t* out, size_t samples, float gain) {
+  constexpr float Scale = 2147483648.f;
+  const float mul = gain * Scale;
+  const float high = ClipHigh(Scale);
+  size_t s = 0;
+#if __SSE__
+  const __m128 mulVec = _mm_set1_ps(mul);
+  const __m128 lowVec = _mm_set1_ps(-Scale);
+  const __m128 highVec = _mm_set1_ps(high);
+  for (; s + 4 <= samples; s += 4)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + s), QuantizeVec(in + s, mulVec, lowVec, highVec, nullptr));
+#endif
+  for (; s < samples; ++s)
+    out[s] = Quantize(in[s], mul, Scale, high, nullptr);
+}
+
+void ConvertToInt24(const float* in, uint8_t* out, size_t samples, float gain, DitherState* dither) {
+  constexpr float Scale = 8388608.f;
+  const float mul = gain * Scale;
+  const float high = ClipHigh(Scale);
+  size_t s = 0;
+  if (dither)
+    dither->m_lane = 0;
+#if __SSE__
+  const __m128 mulVec = _mm_set1_ps(mul);
+  const __m128 lowVec = _mm_set1_ps(-Scale);
+  const __m128 highVec = _mm_set1_ps(high);
+  __m128i seeds = _mm_setzero_si128();
+  if (dither)
+    seeds = _mm_load_si128(reinterpret_cast<const __m128i*>(dither->m_seeds));
+  __m128i* seedsPtr = dither ? &seeds : nullptr;
+  alignas(16) int32_t quant[4];
+  for (; s + 4 <= samples; s += 4) {
+    _mm_store_si128(reinterpret_cast<__m128i*>(quant), QuantizeVec(in + s, mulVec, lowVec, highVec, seedsPtr));
+    for (int i = 0; i < 4; ++i, out += 3) {
+      out[0] = uint8_t(quant[i]);
+      out[1] = uint8_t(quant[i] >> 8);
+      out[2] = uint8_t(quant[i] >> 16);
+    }
+  }
+  if (dither)
+    _mm_store_si128(reinterpret_cast<__m128i*>(dither->m_seeds), seeds);
+#endif
+  for (; s < samples; ++s, out += 3) {
+    int32_t quant = Quantize(in[s], mul, Scale, high, dither);
+    out[0] = uint8_t(quant);
+    out[1] = uint8_t(quant >> 8);
+    out[2] = uint8_t(quant >> 16);
+  }
+}
+
+} // namespace boo
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace boo {
+
+/** xorshift32 lanes generating TPDF dither noise. Each conversion dithers its sample i from lane i % 4, whether
+ *  the vector loop or the scalar tail converts it, so both paths draw the same noise */
+struct DitherState {
+  alignas(16) uint32_t m_seeds[4] = {0x9E3779B9, 0x7F4A7C15, 0x94D049BB, 0xBF58476D};
+  unsigned m_lane = 0;
+
+  /* Difference of two uniform draws; triangular distribution over (-1, 1) LSB */
+  float next() {
+    uint32_t& s = m_seeds[m_lane];
+    m_lane = (m_lane + 1) & 3;
+    float a = _nextUnit(s);
+    return a - _nextUnit(s);
+  }
+
+private:
+  static float _nextUnit(uint32_t& s) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    uint32_t bits = (s >> 9) | 0x3f800000;
+    float ret;
+    memcpy(&ret, &bits, 4);
+    return ret - 1.f;
+  }
+};
+
+/* Convert normalized float samples to integer PCM: multiply by gain, scale to full range, optionally
+ * add TPDF dither, then clip and round to nearest. Pass a null dither for plain rounding. */
+void ConvertToInt16(const float* in, int16_t* out, size_t samples, float gain, DitherState* dither);
+
+/* Never dithered: a float's 24-bit mantissa already quantizes far more coarsely than 1 LSB of 2^31 */
+void ConvertToInt32(const float* in, int32_t* out, size_t samples, float gain);
+
+/* Packed little-endian 24-bit output */
+void ConvertToInt24(const float* in, uint8_t* out, size_t samples, float gain, DitherState* dither);
+
+} // namespace boo
@@ -0,0 +1,221 @@
+#include "lib/audiodev/AudioResamplerPool.hpp"
+
+#include <algorithm>
+
+#include <logvisor/logvisor.hpp>
+
+namespace boo {
+static logvisor::Module Log("boo::AudioResamplerPool");
+
+static unsigned long SoxrRecipe(AudioVoiceQuality quality) {
+  switch (quality) {
+  case AudioVoiceQuality::Quick:
+    return SOXR_QQ;
+  case AudioVoiceQuality::Low:
+    return SOXR_LQ;
+  case AudioVoiceQuality::Medium:
+    return SOXR_MQ;
+  case AudioVoiceQuality::VeryHigh:
+    return SOXR_VHQ;
+  case AudioVoiceQuality::High:
+  default:
+    return SOXR_HQ;
+  }
+}
+
+static soxr_datatype_t SoxrInputType(AudioSourceFormat format) {
+  switch (format) {
+  case AudioSourceFormat::Int32:
+    return SOXR_INT32_I;
+  case AudioSourceFormat::Float:
+    return SOXR_FLOAT32_I;
+  case AudioSourceFormat::Int16:
+  default:
+    return SOXR_INT16_I;
+  }
+}
+
+AudioResamplerPool::AudioResamplerPool() {
+  m_requests.reserve(MaxRequests);
+  m_thread = std::thread(&AudioResamplerPool::_threadProc, this);
+}
+
+AudioResamplerPool::~AudioResamplerPool() {
+  m_shutdown.store(true, std::memory_order_relaxed);
+  _wake();
+  m_thread.join();
+
+  for (AudioResampler* res = m_returned.exchange(nullptr, std::memory_order_acquire); res;) {
+    AudioResampler* next = res->m_next;
+    _destroy(res);
+    res = next;
+  }
+  purge();
+}
+
+void AudioResamplerPool::_threadProc() {
+  logvisor::RegisterThreadName("Boo Resampler");
+  std::vector<AudioResamplerKey> requests;
+  requests.reserve(MaxRequests);
+  while (true) {
+    /* Releases and requests made while working bump m_wakeups and cut the following wait short */
+    size_t wakeups = m_wakeups.load(std::memory_order_acquire);
+    if (m_shutdown.load(std::memory_order_relaxed))
+      break;
+
+    _recycle(m_returned.exchange(nullptr, std::memory_order_acquire));
+
+    size_t generation;
+    {
+      /* Both vectors keep their reserved capacity as they trade places */
+      std::unique_lock lk(m_mutex);
+      requests.swap(m_requests);
+      generation = m_generation;
+    }
+    for (const AudioResamplerKey& key : requests) {
+      soxr_error_t err;
+      if (AudioResampler* res = _create(key, err)) {
+        res->m_generation = generation;
+        _park(res);
+      } else {
+        Log.report(logvisor::Fatal, FMT_STRING("unable to create soxr resampler: {}"), soxr_strerror(err));
+      }
+    }
+    requests.clear();
+
+    m_wakeups.wait(wakeups, std::memory_order_acquire);
+  }
+}
+
+void AudioResamplerPool::_recycle(AudioResampler* returned) {
+  while (returned) {
+    AudioResampler* res = returned;
+    returned = res->m_next;
+    if (soxr_clear(res->m_src))
+      _destroy(res);
+    else
+      _park(res);
+  }
+}
+
+void AudioResamplerPool::_park(AudioResampler* res) {
+  std::unique_lock lk(m_mutex);
+  if (res->m_generation != m_generation) {
+    lk.unlock();
+    _destroy(res);
+    return;
+  }
+  _getBucket(res->m_key).m_free.push_back(res);
+}
+
+AudioResamplerPool::Bucket& AudioResamplerPool::_getBucket(const AudioResamplerKey& key) {
+  /* Engines see a handful of distinct source rates, so a linear scan beats hashing doubles */
+  for (Bucket& bucket : m_buckets)
+    if (bucket.m_key == key)
+      return bucket;
+  return m_buckets.emplace_back(Bucket{key, {}});
+}
+
+AudioResampler* AudioResamplerPool::_create(const AudioResamplerKey& key, soxr_error_t& err) {
+  soxr_io_spec_t ioSpec = soxr_io_spec(SoxrInputType(key.m_formatIn), key.m_formatOut);
+  soxr_quality_spec_t qSpec = soxr_quality_spec(SoxrRecipe(key.m_quality), key.m_dynamicRate ? SOXR_VR : 0);
+  soxr_t src = soxr_create(key.m_rateIn, key.m_rateOut, key.m_channels, &err, &ioSpec, &qSpec, nullptr);
+  if (!src)
+    return nullptr;
+  return new AudioResampler{key, src};
+}
+
+void AudioResamplerPool::_destroy(AudioResampler* res) {
+  soxr_delete(res->m_src);
+  delete res;
+}
+
+AudioResampler* AudioResamplerPool::acquire(const AudioResamplerKey& key, soxr_error_t& err) {
+  size_t generation;
+  {
+    std::unique_lock lk(m_mutex);
+    Bucket& bucket = _getBucket(key);
+    if (!bucket.m_free.empty()) {
+      AudioResampler* ret = bucket.m_free.back();
+      bucket.m_free.pop_back();
+      err = nullptr;
+      return ret;
+    }
+    generation = m_generation;
+  }
+  AudioResampler* ret = _create(key, err);
+  if (ret)
+    ret->m_generation = generation;
+  return ret;
+}
+
+AudioResampler* AudioResamplerPool::tryAcquire(const AudioResamplerKey& key) {
+  std::unique_lock lk(m_mutex, std::try_to_lock);
+  if (!lk)
+    return nullptr;
+
+  for (Bucket& bucket : m_buckets) {
+    if (bucket.m_key == key && !bucket.m_free.empty()) {
+      AudioResampler* ret = bucket.m_free.back();
+      bucket.m_free.pop_back();
+      return ret;
+    }
+  }
+
+  /* Voices retry every quantum; one outstanding request per key is enough */
+  if (m_requests.size() < MaxRequests &&
+      std::find(m_requests.begin(), m_requests.end(), key) == m_requests.end()) {
+    m_requests.push_back(key);
+    lk.unlock();
+    _wake();
+  }
+  return nullptr;
+}
+
+void AudioResamplerPool::release(AudioResampler* res) {
+  if (!res)
+    return;
+  res->m_next = m_returned.load(std::memory_order_relaxed);
+  while (!m_returned.compare_exchange_weak(res->m_next, res, std::memory_order_release, std::memory_order_relaxed))
+    ;
+  _wake();
+}
+
+void AudioResamplerPool::warm(const AudioResamplerKey& key, size_t count) {
+  size_t have;
+  size_t generation;
+  {
+    std::unique_lock lk(m_mutex);
+    have = _getBucket(key).m_free.size();
+    generation = m_generation;
+  }
+
+  std::vector<AudioResampler*> created;
+  created.reserve(count > have ? count - have : 0);
+  for (size_t i = have; i < count; ++i) {
+    soxr_error_t err;
+    if (AudioResampler* res = _create(key, err)) {
+      res->m_generation = generation;
+      created.push_back(res);
+    } else {
+      break;
+    }
+  }
+
+  for (AudioResampler* res : created)
+    _park(res);
+}
+
+void AudioResamplerPool::purge() {
+  std::vector<Bucket> buckets;
+  {
+    std::unique_lock lk(m_mutex);
+    buckets.swap(m_buckets);
+    ++m_generation;
+  }
+  for (Bucket& bucket : buckets)
+    for (AudioResampler* res : bucket.m_free)
+      _destroy(res);
+}
+
+} // namespace boo
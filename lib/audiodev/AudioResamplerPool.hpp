@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "boo/audiodev/IAudioVoice.hpp"
+
+#include <soxr.h>
+
+namespace boo {
+
+/** Configuration a pooled resampler was designed for; instances are only shared between equal keys */
+struct AudioResamplerKey {
+  double m_rateIn = 0.0;
+  double m_rateOut = 0.0;
+  unsigned m_channels = 0;
+  AudioSourceFormat m_formatIn = AudioSourceFormat::Int16;
+  soxr_datatype_t m_formatOut = SOXR_FLOAT32_I;
+  AudioVoiceQuality m_quality = AudioVoiceQuality::High;
+  bool m_dynamicRate = false;
+
+  bool operator==(const AudioResamplerKey& other) const = default;
+};
+
+/** soxr instance lent out by an AudioResamplerPool */
+struct AudioResampler {
+  AudioResamplerKey m_key;
+  soxr_t m_src = nullptr;
+
+  /* Pool generation at creation; instances created before a purge are destroyed instead of parked */
+  size_t m_generation = 0;
+
+  /* Link within the pool's stack of returned instances */
+  AudioResampler* m_next = nullptr;
+};
+
+/** Recycles soxr resamplers between voices so that allocating a voice performs no filter design.
+ *  Released instances are pushed onto a lock-free stack from any thread; a background thread clears
+ *  them (which redesigns their filters) and parks them until a voice with the same key acquires them.
+ *  Mixing threads acquire with tryAcquire, which never blocks or designs filters: a miss asks the
+ *  background thread for an instance that a later quantum picks up. warm() fills the pool ahead of time. */
+class AudioResamplerPool {
+  struct Bucket {
+    AudioResamplerKey m_key;
+    std::vector<AudioResampler*> m_free;
+  };
+
+  std::mutex m_mutex;
+  std::vector<Bucket> m_buckets;
+  size_t m_generation = 0;
+
+  /* Keys missed by tryAcquire; capacity is reserved up front so requesting never allocates */
+  static constexpr size_t MaxRequests = 64;
+  std::vector<AudioResamplerKey> m_requests;
+
+  /* Released instances awaiting the background thread */
+  std::atomic<AudioResampler*> m_returned = nullptr;
+
+  std::thread m_thread;
+  std::atomic_size_t m_wakeups = 0;
+  std::atomic_bool m_shutdown = false;
+
+  void _threadProc();
+  void _wake() {
+    m_wakeups.fetch_add(1, std::memory_order_release);
+    m_wakeups.notify_one();
+  }
+  void _recycle(AudioResampler* returned);
+  void _park(AudioResampler* res);
+
+  Bucket& _getBucket(const AudioResamplerKey& key);
+  static AudioResampler* _create(const AudioResamplerKey& key, soxr_error_t& err);
+  static void _destroy(AudioResampler* res);
+
+public:
+  AudioResamplerPool();
+  AudioResamplerPool(const AudioResamplerPool&) = delete;
+  AudioResamplerPool& operator=(const AudioResamplerPool&) = delete;
+  ~AudioResamplerPool();
+
+  /** Pop an idle resampler for key or create one; returns nullptr and sets err on failure */
+  AudioResampler* acquire(const AudioResamplerKey& key, soxr_error_t& err);
+
+  /** Pop an idle resampler for key without blocking (for mixing threads); on a miss, returns nullptr
+   *  and has the background thread create one for a later call */
+  AudioResampler* tryAcquire(const AudioResamplerKey& key);
+
+  /** Hand res back for clearing and reuse; lock-free and callable from any thread */
+  void release(AudioResampler* res);
+
+  /** Ensure at least count idle resamplers exist for key */
+  void warm(const AudioResamplerKey& key, size_t count);
+
+  /** Destroy all idle resamplers, and any released later that were acquired before this call
+   *  (e.g. after the mix format changes) */
+  void purge();
+};
+
+} // namespace boo
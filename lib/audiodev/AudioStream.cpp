@@ -0,0 +1,198 @@
+#include "lib/audiodev/AudioStream.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <logvisor/logvisor.hpp>
+
+namespace boo {
+
+static size_t SampleBytes(AudioSourceFormat format) {
+  switch (format) {
+  case AudioSourceFormat::Int32:
+  case AudioSourceFormat::Float:
+    return 4;
+  case AudioSourceFormat::Int16:
+  default:
+    return 2;
+  }
+}
+
+AudioStream::AudioStream(AudioStreamPool& pool, IAudioVoiceCallback* cb, IAudioStreamSource* source,
+                         AudioSourceFormat format, unsigned channels, size_t capacity)
+: m_pool(pool)
+, m_cb(cb)
+, m_source(source)
+, m_format(format)
+, m_frameBytes(SampleBytes(format) * channels)
+, m_capacity(capacity)
+, m_refillFrames(std::max(capacity / 4, size_t(1)))
+, m_ring(new uint8_t[capacity * m_frameBytes]) {}
+
+void AudioStream::fill() {
+  if (m_closed || m_filling.test_and_set())
+    return;
+  /* Recheck now that the flag is held; remove() closes before waiting on it */
+  if (!m_closed && !m_ended.load(std::memory_order_relaxed)) {
+    m_wantFill.store(false, std::memory_order_relaxed);
+    size_t writePos = m_writePos.load(std::memory_order_relaxed);
+    while (size_t space = m_capacity - (writePos - m_readPos.load(std::memory_order_acquire))) {
+      size_t offset = writePos % m_capacity;
+      size_t frames = std::min(space, m_capacity - offset);
+      uint8_t* data = m_ring.get() + offset * m_frameBytes;
+      size_t done;
+      switch (m_format) {
+      case AudioSourceFormat::Int32:
+        done = m_source->readAudio(frames, reinterpret_cast<int32_t*>(data));
+        break;
+      case AudioSourceFormat::Float:
+        done = m_source->readAudio(frames, reinterpret_cast<float*>(data));
+        break;
+      case AudioSourceFormat::Int16:
+      default:
+        done = m_source->readAudio(frames, reinterpret_cast<int16_t*>(data));
+        break;
+      }
+      writePos += std::min(done, frames);
+      m_writePos.store(writePos, std::memory_order_release);
+      if (done < frames) {
+        m_ended.store(true, std::memory_order_release);
+        break;
+      }
+    }
+  }
+  m_filling.clear();
+  m_filling.notify_all();
+}
+
+size_t AudioStream::_consume(void* data, size_t frames) {
+  size_t readPos = m_readPos.load(std::memory_order_relaxed);
+  size_t avail = m_writePos.load(std::memory_order_acquire) - readPos;
+
+  size_t debt = std::min(m_skipDebt, avail);
+  m_skipDebt -= debt;
+  readPos += debt;
+  avail -= debt;
+
+  size_t done = std::min(avail, frames);
+  if (data) {
+    size_t offset = readPos % m_capacity;
+    size_t first = std::min(done, m_capacity - offset);
+    memcpy(data, m_ring.get() + offset * m_frameBytes, first * m_frameBytes);
+    memcpy(static_cast<uint8_t*>(data) + first * m_frameBytes, m_ring.get(), (done - first) * m_frameBytes);
+  }
+  m_readPos.store(readPos + done, std::memory_order_release);
+
+  if (m_capacity - (avail - done) >= m_refillFrames && !m_ended.load(std::memory_order_relaxed) &&
+      !m_wantFill.exchange(true, std::memory_order_relaxed))
+    m_pool.wake();
+  return done;
+}
+
+template <typename S>
+size_t AudioStream::_supplyAudio(size_t frames, S* data) {
+  /* Frames published before the end flag are all visible to the copy that follows */
+  bool ended = m_ended.load(std::memory_order_acquire);
+  size_t done = _consume(data, frames);
+  if (done == frames || ended)
+    return done;
+
+  /* The ring ran dry ahead of the source; keep time with silence */
+  memset(reinterpret_cast<uint8_t*>(data) + done * m_frameBytes, 0, (frames - done) * m_frameBytes);
+  return frames;
+}
+
+size_t AudioStream::supplyAudio(IAudioVoice& voice, size_t frames, int16_t* data) {
+  return _supplyAudio(frames, data);
+}
+
+size_t AudioStream::supplyAudio(IAudioVoice& voice, size_t frames, int32_t* data) {
+  return _supplyAudio(frames, data);
+}
+
+size_t AudioStream::supplyAudio(IAudioVoice& voice, size_t frames, float* data) { return _supplyAudio(frames, data); }
+
+bool AudioStream::skipAudio(IAudioVoice& voice, size_t frames) {
+  m_skipDebt += frames - _consume(nullptr, frames);
+  return true;
+}
+
+AudioStreamPool::~AudioStreamPool() { _stopThreads(); }
+
+void AudioStreamPool::_threadProc(size_t threadIdx) {
+  logvisor::RegisterThreadName(fmt::format(FMT_STRING("Boo Stream {}"), threadIdx).c_str());
+  std::vector<std::shared_ptr<AudioStream>> streams;
+  while (true) {
+    /* Requests raised while scanning bump the generation and cut the following wait short */
+    size_t generation = m_generation.load(std::memory_order_acquire);
+    if (m_shutdown.load(std::memory_order_relaxed))
+      break;
+    {
+      std::unique_lock lk(m_mutex);
+      streams = m_streams;
+    }
+    for (const std::shared_ptr<AudioStream>& stream : streams)
+      if (stream->m_wantFill.load(std::memory_order_relaxed))
+        stream->fill();
+    streams.clear();
+    m_generation.wait(generation, std::memory_order_acquire);
+  }
+}
+
+void AudioStreamPool::_startThreads() {
+  for (size_t t = 0; t < m_threadCount; ++t)
+    m_threads.emplace_back(&AudioStreamPool::_threadProc, this, t);
+}
+
+void AudioStreamPool::_stopThreads() {
+  if (m_threads.empty())
+    return;
+  m_shutdown.store(true, std::memory_order_relaxed);
+  wake();
+  for (std::thread& thread : m_threads)
+    thread.join();
+  m_threads.clear();
+  m_shutdown.store(false, std::memory_order_relaxed);
+}
+
+void AudioStreamPool::setThreadCount(size_t count) {
+  std::unique_lock lk(m_threadMutex);
+  _stopThreads();
+  m_threadCount = std::max(count, size_t(1));
+  bool haveStreams;
+  {
+    std::unique_lock streamsLk(m_mutex);
+    haveStreams = !m_streams.empty();
+  }
+  if (haveStreams)
+    _startThreads();
+}
+
+void AudioStreamPool::add(std::shared_ptr<AudioStream> stream) {
+  /* The first fill happens on a stream thread like any other, keeping source reads off the caller */
+  stream->m_wantFill.store(true, std::memory_order_relaxed);
+  {
+    std::unique_lock lk(m_mutex);
+    m_streams.push_back(std::move(stream));
+  }
+  std::unique_lock lk(m_threadMutex);
+  if (m_threads.empty())
+    _startThreads();
+  else
+    wake();
+}
+
+void AudioStreamPool::remove(AudioStream* stream) {
+  stream->m_closed = true;
+  {
+    std::unique_lock lk(m_mutex);
+    auto it = std::find_if(m_streams.begin(), m_streams.end(),
+                           [stream](const std::shared_ptr<AudioStream>& other) { return other.get() == stream; });
+    if (it != m_streams.end())
+      m_streams.erase(it);
+  }
+  while (stream->m_filling.test())
+    stream->m_filling.wait(true);
+}
+
+} // namespace boo
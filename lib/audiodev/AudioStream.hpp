@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "boo/audiodev/IAudioVoice.hpp"
+
+namespace boo {
+class AudioStreamPool;
+
+/* Shortest prefetch ring of a streaming voice */
+constexpr double MinStreamPrefetchSeconds = 0.02;
+
+/** Prefetch ring of a streaming voice, standing in as the voice's IAudioVoiceCallback.
+ *  A stream thread produces into the ring by reading the client's IAudioStreamSource; the mixing thread
+ *  consumes it from supplyAudio and skipAudio without locking or blocking, and wakes the stream threads
+ *  once a quarter of the ring has drained. Other callback methods are forwarded to the client. */
+class AudioStream : public IAudioVoiceCallback {
+  friend class AudioStreamPool;
+
+  AudioStreamPool& m_pool;
+  IAudioVoiceCallback* m_cb;
+  IAudioStreamSource* m_source;
+  AudioSourceFormat m_format;
+  size_t m_frameBytes;
+  size_t m_capacity;
+  size_t m_refillFrames;
+  std::unique_ptr<uint8_t[]> m_ring;
+
+  /* Monotonic frame counters; the producer advances m_writePos, the consumer m_readPos */
+  alignas(64) std::atomic_size_t m_writePos = 0;
+  alignas(64) std::atomic_size_t m_readPos = 0;
+
+  /* Frames skipped while the ring was dry, discarded from the consumer's side as they arrive */
+  size_t m_skipDebt = 0;
+
+  /* Set once the source returned short, after its final frames were published */
+  std::atomic_bool m_ended = false;
+
+  /* Raised by the consumer to request a refill; lowered by the producer as it starts one */
+  std::atomic_bool m_wantFill = false;
+
+  /* m_filling is held while a producer reads the source; m_closed turns producers away for good */
+  std::atomic_bool m_closed = false;
+  std::atomic_flag m_filling;
+
+  /* Consumer: copy up to frames into data (or discard them when null); returns frames taken */
+  size_t _consume(void* data, size_t frames);
+
+  template <typename S>
+  size_t _supplyAudio(size_t frames, S* data);
+
+public:
+  AudioStream(AudioStreamPool& pool, IAudioVoiceCallback* cb, IAudioStreamSource* source, AudioSourceFormat format,
+              unsigned channels, size_t capacity);
+
+  /** Producer: read the source into all free ring space, unless another thread already is */
+  void fill();
+
+  /** Whether the first fill has published frames (or found the source already ended) */
+  bool primed() const {
+    return m_writePos.load(std::memory_order_acquire) != 0 || m_ended.load(std::memory_order_acquire);
+  }
+
+  void preSupplyAudio(IAudioVoice& voice, double dt) override { m_cb->preSupplyAudio(voice, dt); }
+  size_t supplyAudio(IAudioVoice& voice, size_t frames, int16_t* data) override;
+  size_t supplyAudio(IAudioVoice& voice, size_t frames, int32_t* data) override;
+  size_t supplyAudio(IAudioVoice& voice, size_t frames, float* data) override;
+  bool skipAudio(IAudioVoice& voice, size_t frames) override;
+  void routeAudio(size_t frames, size_t channels, double dt, int busId, int16_t* in, int16_t* out) override {
+    m_cb->routeAudio(frames, channels, dt, busId, in, out);
+  }
+  void routeAudio(size_t frames, size_t channels, double dt, int busId, int32_t* in, int32_t* out) override {
+    m_cb->routeAudio(frames, channels, dt, busId, in, out);
+  }
+  void routeAudio(size_t frames, size_t channels, double dt, int busId, float* in, float* out) override {
+    m_cb->routeAudio(frames, channels, dt, busId, in, out);
+  }
+};
+
+/** Background threads keeping the rings of all streaming voices topped up.
+ *  Threads start with the first stream and sleep until a mixing thread requests a refill. */
+class AudioStreamPool {
+  std::mutex m_mutex;
+  std::vector<std::shared_ptr<AudioStream>> m_streams;
+
+  /* Serializes starting and stopping the threads, which take m_mutex themselves */
+  std::mutex m_threadMutex;
+  std::vector<std::thread> m_threads;
+  size_t m_threadCount = 1;
+  std::atomic_size_t m_generation = 0;
+  std::atomic_bool m_shutdown = false;
+
+  void _threadProc(size_t threadIdx);
+  void _startThreads();
+  void _stopThreads();
+
+public:
+  AudioStreamPool() = default;
+  AudioStreamPool(const AudioStreamPool&) = delete;
+  AudioStreamPool& operator=(const AudioStreamPool&) = delete;
+  ~AudioStreamPool();
+
+  /** Restart the pool with count threads */
+  void setThreadCount(size_t count);
+
+  /** Begin refilling stream in the background, starting with a first fill of its whole ring */
+  void add(std::shared_ptr<AudioStream> stream);
+
+  /** Stop refilling stream; returns once no thread is reading its source */
+  void remove(AudioStream* stream);
+
+  /** Wake the threads to refill streams that requested it (called from mixing threads) */
+  void wake() {
+    m_generation.fetch_add(1, std::memory_order_release);
+    m_generation.notify_all();
+  }
+};
+
+} // namespace boo
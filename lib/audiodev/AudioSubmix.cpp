@@ -11,59 +11,27 @@ namespace boo {
 
 AudioSubmix::AudioSubmix(BaseAudioVoiceEngine& root, IAudioSubmixCallback* cb, int busId, bool mainOut)
 : ListNode<AudioSubmix, BaseAudioVoiceEngine*, IAudioSubmix>(&root), m_busId(busId), m_mainOut(mainOut), m_cb(cb) {
-  if (mainOut)
-    setSendLevel(m_head->m_mainSubmix.get(), 1.f, false);
+  if (mainOut) {
+    /* Routed before any other thread can reach the submix, so voices sent to it are heard from the first
+     * quantum rather than after the send command drains */
+    auto lk = _getHeadLock(m_head);
+    m_sendGains.emplace(m_head->m_mainSubmix.get()).m_value = {1.f, 1.f};
+    m_head->_updateMixPlan();
+  }
 }
 
-AudioSubmix::~AudioSubmix() { m_head->m_submixesDirty = true; }
+AudioSubmix::~AudioSubmix() {
+  m_head->_cancelCommands(this);
+  m_sendGains.clear();
+  m_head->_updateMixPlan();
+}
 
 AudioSubmix*& AudioSubmix::_getHeadPtr(BaseAudioVoiceEngine* head) { return head->m_submixHead; }
 std::unique_lock<std::recursive_mutex> AudioSubmix::_getHeadLock(BaseAudioVoiceEngine* head) {
   return std::unique_lock<std::recursive_mutex>{head->m_dataMutex};
 }
 
-bool AudioSubmix::_isDirectDependencyOf(AudioSubmix* send) { return m_sendGains.find(send) != m_sendGains.cend(); }
-
-bool AudioSubmix::_mergeC3(std::list<AudioSubmix*>& output, std::vector<std::list<AudioSubmix*>>& lists) {
-  for (auto outerIt = lists.begin(); outerIt != lists.cend(); ++outerIt) {
-    if (outerIt->empty())
-      continue;
-    AudioSubmix* smx = outerIt->front();
-    bool found = false;
-    for (auto innerIt = lists.begin(); innerIt != lists.cend(); ++innerIt) {
-      if (innerIt->empty() || outerIt == innerIt)
-        continue;
-      if (smx == innerIt->front()) {
-        innerIt->pop_front();
-        found = true;
-      }
-    }
-    if (found) {
-      outerIt->pop_front();
-      output.push_back(smx);
-      return true;
-    }
-  }
-  return false;
-}
-
-std::list<AudioSubmix*> AudioSubmix::_linearizeC3() {
-  std::vector<std::list<AudioSubmix*>> lists = {{}};
-  if (m_head->m_submixHead)
-    for (AudioSubmix& smx : *m_head->m_submixHead) {
-      if (&smx == this)
-        continue;
-      if (smx._isDirectDependencyOf(this))
-        lists[0].push_back(&smx);
-    }
-  lists.reserve(lists[0].size() + 1);
-  for (AudioSubmix* smx : lists[0])
-    lists.push_back(smx->_linearizeC3());
-
-  std::list<AudioSubmix*> ret = {this};
-  while (_mergeC3(ret, lists)) {}
-  return ret;
-}
+bool AudioSubmix::_isDirectDependencyOf(AudioSubmix* send) { return m_sendGains.find(send) != nullptr; }
 
 template <typename T>
 void AudioSubmix::_zeroFill() {
@@ -109,27 +77,82 @@ constexpr T ClampInt(float in) {
 }
 
 template <typename T>
-size_t AudioSubmix::_pumpAndMix(size_t frames) {
+void AudioSubmix::_mergeFrom(const T* in, size_t frames) {
+  T* out = _getMergeBuf<T>(frames);
+  size_t sampleCount = frames * m_head->clientMixInfo().m_channelMap.m_channelCount;
+  for (size_t i = 0; i < sampleCount; ++i)
+    out[i] = ClampInt<T>(float(out[i]) + in[i]);
+}
+
+template void AudioSubmix::_mergeFrom<int16_t>(const int16_t* in, size_t frames);
+template void AudioSubmix::_mergeFrom<int32_t>(const int32_t* in, size_t frames);
+template void AudioSubmix::_mergeFrom<float>(const float* in, size_t frames);
+
+template <typename T>
+void AudioSubmix::_getPlanes(std::array<T*, 8>& planes, size_t frames, unsigned chanCount) {
+  size_t stride = (frames * sizeof(T) + AudioPlanarAlignment - 1) & ~(AudioPlanarAlignment - 1);
+  size_t needed = stride * chanCount + AudioPlanarAlignment - 1;
+  if (m_planarStorage.size() < needed)
+    m_planarStorage.resize(needed);
+
+  uintptr_t base = reinterpret_cast<uintptr_t>(m_planarStorage.data());
+  base = (base + AudioPlanarAlignment - 1) & ~uintptr_t(AudioPlanarAlignment - 1);
+  for (unsigned c = 0; c < chanCount; ++c)
+    planes[c] = reinterpret_cast<T*>(base + stride * c);
+}
+
+template <typename T>
+void AudioSubmix::_applyEffect(T* audio, size_t frames, const ChannelMap& chMap) {
+  if (!m_cb || !m_cb->canApplyEffect())
+    return;
+
+  double sampleRate = m_head->mixInfo().m_sampleRate;
+  if (!m_cb->wantsPlanarEffect()) {
+    m_cb->applyEffect(audio, frames, chMap, sampleRate);
+    return;
+  }
+
+  unsigned chanCount = chMap.m_channelCount;
+  std::array<T*, 8> planes{};
+  _getPlanes<T>(planes, frames, chanCount);
+
+  for (unsigned c = 0; c < chanCount; ++c) {
+    const T* in = audio + c;
+    T* plane = planes[c];
+    for (size_t f = 0; f < frames; ++f, in += chanCount)
+      plane[f] = *in;
+  }
+
+  m_cb->applyEffect(planes.data(), frames, chMap, sampleRate);
+
+  for (unsigned c = 0; c < chanCount; ++c) {
+    T* out = audio + c;
+    const T* plane = planes[c];
+    for (size_t f = 0; f < frames; ++f, out += chanCount)
+      *out = plane[f];
+  }
+}
+
+template <typename T>
+size_t AudioSubmix::_pumpAndMix(size_t frames, const AudioMixPlan& plan, size_t planIdx) {
   const ChannelMap& chMap = m_head->clientMixInfo().m_channelMap;
   size_t chanCount = chMap.m_channelCount;
 
   if (_getRedirect<T>()) {
-    if (m_cb && m_cb->canApplyEffect())
-      m_cb->applyEffect(_getRedirect<T>(), frames, chMap, m_head->mixInfo().m_sampleRate);
+    _applyEffect(_getRedirect<T>(), frames, chMap);
     _getRedirect<T>() += chanCount * frames;
   } else {
     size_t sampleCount = frames * chanCount;
     if (_getScratch<T>().size() < sampleCount)
       _getScratch<T>().resize(sampleCount);
-    if (m_cb && m_cb->canApplyEffect())
-      m_cb->applyEffect(_getScratch<T>().data(), frames, chMap, m_head->mixInfo().m_sampleRate);
+    _applyEffect(_getScratch<T>().data(), frames, chMap);
 
     size_t curSlewFrame = m_slewFrames;
-    for (auto& smx : m_sendGains) {
+    for (size_t s = plan.m_sendBegin[planIdx]; s < plan.m_sendBegin[planIdx + 1]; ++s) {
       curSlewFrame = m_curSlewFrame;
-      AudioSubmix& sm = *reinterpret_cast<AudioSubmix*>(smx.first);
+      const std::array<float, 2>& gains = m_sendGains.begin()[plan.m_sends[s].m_gains].m_value;
       auto it = _getScratch<T>().begin();
-      T* dataOut = sm._getMergeBuf<T>(frames);
+      T* dataOut = plan.m_order[plan.m_sends[s].m_target]->_getMergeBuf<T>(frames);
 
       for (size_t f = 0; f < frames; ++f) {
         if (m_slewFrames && curSlewFrame < m_slewFrames) {
@@ -137,7 +160,7 @@ size_t AudioSubmix::_pumpAndMix(size_t frames) {
           double omt = 1.0 - t;
 
           for (unsigned c = 0; c < chanCount; ++c) {
-            *dataOut = ClampInt<T>(*dataOut + *it * (smx.second[1] * t + smx.second[0] * omt));
+            *dataOut = ClampInt<T>(*dataOut + *it * (gains[1] * t + gains[0] * omt));
             ++it;
             ++dataOut;
           }
@@ -145,7 +168,7 @@ size_t AudioSubmix::_pumpAndMix(size_t frames) {
           ++curSlewFrame;
         } else {
           for (unsigned c = 0; c < chanCount; ++c) {
-            *dataOut = ClampInt<T>(*dataOut + *it * smx.second[1]);
+            *dataOut = ClampInt<T>(*dataOut + *it * gains[1]);
             ++it;
             ++dataOut;
           }
@@ -158,9 +181,9 @@ size_t AudioSubmix::_pumpAndMix(size_t frames) {
   return frames;
 }
 
-template size_t AudioSubmix::_pumpAndMix<int16_t>(size_t frames);
-template size_t AudioSubmix::_pumpAndMix<int32_t>(size_t frames);
-template size_t AudioSubmix::_pumpAndMix<float>(size_t frames);
+template size_t AudioSubmix::_pumpAndMix<int16_t>(size_t frames, const AudioMixPlan& plan, size_t planIdx);
+template size_t AudioSubmix::_pumpAndMix<int32_t>(size_t frames, const AudioMixPlan& plan, size_t planIdx);
+template size_t AudioSubmix::_pumpAndMix<float>(size_t frames, const AudioMixPlan& plan, size_t planIdx);
 
 void AudioSubmix::_resetOutputSampleRate() {
   if (m_cb)
@@ -168,24 +191,48 @@ void AudioSubmix::_resetOutputSampleRate() {
 }
 
 void AudioSubmix::resetSendLevels() {
-  if (m_sendGains.empty())
-    return;
-  m_sendGains.clear();
-  m_head->m_submixesDirty = true;
+  AudioCommand cmd(AudioCommandType::SubmixResetSendLevels, this);
+  m_head->_submitCommand(cmd);
 }
 
-void AudioSubmix::setSendLevel(IAudioSubmix* submix, float level, bool slew) {
-  auto search = m_sendGains.find(submix);
-  if (search == m_sendGains.cend()) {
-    search = m_sendGains.emplace(submix, std::array<float, 2>{1.f, 1.f}).first;
-    m_head->m_submixesDirty = true;
-  }
-
+void AudioSubmix::_setSendLevel(std::array<float, 2>& gains, float level, bool slew) {
   m_slewFrames = slew ? m_head->m_5msFrames : 0;
   m_curSlewFrame = 0;
 
-  search->second[0] = search->second[1];
-  search->second[1] = level;
+  gains[0] = gains[1];
+  gains[1] = level;
+}
+
+void AudioSubmix::_applyCommand(const AudioCommand& cmd) {
+  switch (cmd.m_type) {
+  case AudioCommandType::SubmixSendLevel:
+    if (auto* send = m_sendGains.find(cmd.m_send)) {
+      _setSendLevel(send->m_value, cmd.m_level, cmd.m_slew);
+    } else {
+      /* New sends change the topology; the pump rebuilds the mix plan before mixing the quantum */
+      auto& newSend = m_sendGains.emplace(cmd.m_send);
+      newSend.m_value = {1.f, 1.f};
+      _setSendLevel(newSend.m_value, cmd.m_level, cmd.m_slew);
+      m_head->m_mixPlanDirty = true;
+    }
+    break;
+  case AudioCommandType::SubmixResetSendLevels:
+    if (!m_sendGains.empty()) {
+      m_sendGains.clear();
+      m_head->m_mixPlanDirty = true;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void AudioSubmix::setSendLevel(IAudioSubmix* submix, float level, bool slew) {
+  AudioCommand cmd(AudioCommandType::SubmixSendLevel, this);
+  cmd.m_send = submix;
+  cmd.m_level = level;
+  cmd.m_slew = slew;
+  m_head->_submitCommand(cmd);
 }
 
 const AudioVoiceEngineMixInfo& AudioSubmix::mixInfo() const { return m_head->mixInfo(); }
@@ -3,9 +3,7 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
-#include <list>
 #include <mutex>
-#include <unordered_map>
 #include <vector>
 
 #include "boo/audiodev/IAudioSubmix.hpp"
@@ -25,11 +23,15 @@ struct WAVOutVoiceEngine;
 namespace boo {
 class BaseAudioVoiceEngine;
 class AudioVoice;
+struct AudioCommand;
+struct AudioMixPlan;
+struct AudioMixScratch;
 struct AudioVoiceEngineMixInfo;
 /* Output gains for each mix-send/channel */
 
 class AudioSubmix : public ListNode<AudioSubmix, BaseAudioVoiceEngine*, IAudioSubmix> {
   friend class BaseAudioVoiceEngine;
+  friend struct AudioMixScratch;
   friend class AudioVoiceMono;
   friend class AudioVoiceStereo;
   friend struct WASAPIAudioVoiceEngine;
@@ -41,6 +43,12 @@ class AudioSubmix : public ListNode<AudioSubmix, BaseAudioVoiceEngine*, IAudioSu
   int m_busId;
   bool m_mainOut;
 
+  /* Position within each of the engine's mix plans (-1 when not routed to the main output) */
+  std::array<int, 3> m_mixIdx = {-1, -1, -1};
+
+  /* Loudest send gain from this submix to the main output, refreshed while voices are culled */
+  float m_audibility = 0.f;
+
   /* Callback (effect source, optional) */
   IAudioSubmixCallback* m_cb;
 
@@ -49,7 +57,7 @@ class AudioSubmix : public ListNode<AudioSubmix, BaseAudioVoiceEngine*, IAudioSu
   size_t m_curSlewFrame = 0;
 
   /* Output gains for each mix-send/channel */
-  std::unordered_map<IAudioSubmix*, std::array<float, 2>> m_sendGains;
+  SendTable<std::array<float, 2>> m_sendGains;
 
   /* Temporary scratch buffers for accumulating submix audio */
   std::vector<int16_t> m_scratch16;
@@ -65,10 +73,17 @@ class AudioSubmix : public ListNode<AudioSubmix, BaseAudioVoiceEngine*, IAudioSu
   template <typename T>
   T*& _getRedirect();
 
-  /* C3-linearization support (to mitigate a potential diamond problem on 'clever' submix routes) */
+  /* Per-channel planes for callbacks taking planar audio; allocated on first use */
+  std::vector<uint8_t> m_planarStorage;
+  template <typename T>
+  void _getPlanes(std::array<T*, 8>& planes, size_t frames, unsigned chanCount);
+
+  /* Run the client effect over one quantum of interleaved audio, transposing for planar callbacks */
+  template <typename T>
+  void _applyEffect(T* audio, size_t frames, const ChannelMap& chMap);
+
+  /* Mix plan support; a submix must be pumped before every submix it sends to */
   bool _isDirectDependencyOf(AudioSubmix* send);
-  std::list<AudioSubmix*> _linearizeC3();
-  static bool _mergeC3(std::list<AudioSubmix*>& output, std::vector<std::list<AudioSubmix*>>& lists);
 
   /* Fill scratch buffers with silence for new mix cycle */
   template <typename T>
@@ -78,12 +93,20 @@ class AudioSubmix : public ListNode<AudioSubmix, BaseAudioVoiceEngine*, IAudioSu
   template <typename T>
   T* _getMergeBuf(size_t frames);
 
-  /* Mix scratch buffers into sends */
+  /* Accumulate audio gathered by another mixing thread */
+  template <typename T>
+  void _mergeFrom(const T* in, size_t frames);
+
+  /* Mix scratch buffers into the sends routed by plan, where this submix is at planIdx */
   template <typename T>
-  size_t _pumpAndMix(size_t frames);
+  size_t _pumpAndMix(size_t frames, const AudioMixPlan& plan, size_t planIdx);
 
   void _resetOutputSampleRate();
 
+  /* Parameter changes, applied on the pumping thread */
+  void _setSendLevel(std::array<float, 2>& gains, float level, bool slew);
+  void _applyCommand(const AudioCommand& cmd);
+
 public:
   static AudioSubmix*& _getHeadPtr(BaseAudioVoiceEngine* head);
   static std::unique_lock<std::recursive_mutex> _getHeadLock(BaseAudioVoiceEngine* head);
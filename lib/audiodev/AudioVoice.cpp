@@ -1,7 +1,9 @@
 #include "AudioVoice.hpp"
 #include "AudioVoiceEngine.hpp"
 #include "logvisor/logvisor.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
 namespace boo {
 static logvisor::Module Log("boo::AudioVoice");
@@ -9,20 +11,154 @@ static logvisor::Module Log("boo::AudioVoice");
 static AudioMatrixMono DefaultMonoMtx;
 static AudioMatrixStereo DefaultStereoMtx;
 
-AudioVoice::AudioVoice(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, bool dynamicRate)
-: ListNode<AudioVoice, BaseAudioVoiceEngine*, IAudioVoice>(&root), m_cb(cb), m_dynamicRate(dynamicRate) {}
+/* Rate-matched voices skip the resampler; these match its full-scale mapping of each source format */
+static void ConvertSource(const int16_t* in, int16_t* out, size_t samples) { memmove(out, in, samples * 2); }
 
-AudioVoice::~AudioVoice() { soxr_delete(m_src); }
+static void ConvertSource(const int16_t* in, int32_t* out, size_t samples) {
+  size_t i = 0;
+#if __SSE__
+  for (; i + 8 <= samples; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi16(_mm_setzero_si128(), v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_unpackhi_epi16(_mm_setzero_si128(), v));
+  }
+#endif
+  for (; i < samples; ++i)
+    out[i] = int32_t(in[i]) * 65536;
+}
+
+static void ConvertSource(const int16_t* in, float* out, size_t samples) {
+  constexpr float Scale = 1.f / 32768.f;
+  size_t i = 0;
+#if __SSE__
+  const __m128 scale = _mm_set1_ps(Scale);
+  for (; i + 8 <= samples; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+#endif
+  for (; i < samples; ++i)
+    out[i] = in[i] * Scale;
+}
+
+static void ConvertSource(const int32_t* in, int16_t* out, size_t samples) {
+  for (size_t i = 0; i < samples; ++i)
+    out[i] = int16_t(in[i] >> 16);
+}
+
+static void ConvertSource(const int32_t* in, int32_t* out, size_t samples) { memmove(out, in, samples * 4); }
+
+static void ConvertSource(const int32_t* in, float* out, size_t samples) {
+  constexpr float Scale = 1.f / 2147483648.f;
+  for (size_t i = 0; i < samples; ++i)
+    out[i] = in[i] * Scale;
+}
+
+static void ConvertSource(const float* in, int16_t* out, size_t samples) {
+  for (size_t i = 0; i < samples; ++i)
+    out[i] = Clamp16(in[i] * 32768.f);
+}
+
+static void ConvertSource(const float* in, int32_t* out, size_t samples) {
+  for (size_t i = 0; i < samples; ++i)
+    out[i] = Clamp32(in[i] * 2147483648.f);
+}
+
+static void ConvertSource(const float* in, float* out, size_t samples) { memmove(out, in, samples * 4); }
+
+template <typename S>
+struct SourceTag {
+  using Type = S;
+};
+
+/* Invoke fn with a SourceTag of the sample type the voice's client supplies */
+template <class Fn>
+static auto DispatchSource(AudioSourceFormat format, Fn&& fn) {
+  switch (format) {
+  case AudioSourceFormat::Int32:
+    return fn(SourceTag<int32_t>{});
+  case AudioSourceFormat::Float:
+    return fn(SourceTag<float>{});
+  case AudioSourceFormat::Int16:
+  default:
+    return fn(SourceTag<int16_t>{});
+  }
+}
+
+AudioVoice::AudioVoice(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, unsigned channelCount, bool dynamicRate,
+                       AudioVoiceQuality quality, AudioSourceFormat format)
+: ListNode<AudioVoice, BaseAudioVoiceEngine*, IAudioVoice>(&root)
+, m_cb(cb)
+, m_dynamicRate(dynamicRate)
+, m_quality(quality)
+, m_format(format)
+, m_channelCount(channelCount) {}
+
+AudioVoice::~AudioVoice() {
+  m_head->_cancelCommands(this);
+  _releaseResampler();
+  if (m_stream)
+    m_head->m_streamPool.remove(m_stream.get());
+}
 
 AudioVoice*& AudioVoice::_getHeadPtr(BaseAudioVoiceEngine* head) { return head->m_voiceHead; }
 std::unique_lock<std::recursive_mutex> AudioVoice::_getHeadLock(BaseAudioVoiceEngine* head) {
   return std::unique_lock<std::recursive_mutex>{head->m_dataMutex};
 }
 
+void AudioVoice::_releaseResampler() {
+  m_head->m_resamplerPool.release(m_resampler);
+  m_resampler = nullptr;
+}
+
+AudioResampler* AudioVoice::_acquireResampler(double sampleRate, unsigned channels, bool wait) {
+  const AudioVoiceEngineMixInfo& mixInfo = m_head->mixInfo();
+  AudioResamplerKey key{sampleRate, mixInfo.m_sampleRate, channels, m_format, mixInfo.m_sampleFormat, m_quality,
+                        m_dynamicRate};
+  if (!wait)
+    return m_head->m_resamplerPool.tryAcquire(key);
+
+  soxr_error_t err;
+  AudioResampler* ret = m_head->m_resamplerPool.acquire(key, err);
+  if (!ret)
+    Log.report(logvisor::Fatal, FMT_STRING("unable to create soxr resampler: {}"), soxr_strerror(err));
+  return ret;
+}
+
+bool AudioVoice::_refreshResampler() {
+  if (!m_resamplerStale)
+    return true;
+  _resetSampleRate(m_resetSampleRate ? m_deferredSampleRate : m_sampleRateIn, false);
+  return !m_resamplerStale;
+}
+
+size_t AudioVoice::_skipSourceFrames(size_t frames) {
+  if (m_resampler)
+    m_resamplerStale = true;
+  double srcFrames = frames * m_sampleRatio + m_skipRemainder;
+  size_t ret = size_t(srcFrames);
+  m_skipRemainder = srcFrames - double(ret);
+  return ret;
+}
+
+bool AudioVoice::_isRateMatched(double sampleRate) const {
+  return sampleRate == m_head->mixInfo().m_sampleRate && (!m_dynamicRate || m_pitchRatio == 1.0);
+}
+
 void AudioVoice::_setPitchRatio(double ratio, bool slew) {
   if (m_dynamicRate) {
+    if (!m_resampler) {
+      /* Rate-matched voice starts resampling once pitched */
+      m_setPitchRatio = false;
+      if (ratio != 1.0)
+        _resetSampleRate(m_sampleRateIn, false);
+      return;
+    }
     m_sampleRatio = ratio * m_sampleRateIn / m_sampleRateOut;
-    soxr_error_t err = soxr_set_io_ratio(m_src, m_sampleRatio, slew ? m_head->m_5msFrames : 0);
+    soxr_error_t err = soxr_set_io_ratio(m_resampler->m_src, m_sampleRatio, slew ? m_head->m_5msFrames : 0);
     if (err) {
       Log.report(logvisor::Fatal, FMT_STRING("unable to set resampler rate: {}"), soxr_strerror(err));
       m_setPitchRatio = false;
@@ -34,63 +170,148 @@ void AudioVoice::_setPitchRatio(double ratio, bool slew) {
 
 void AudioVoice::_midUpdate() {
   if (m_resetSampleRate)
-    _resetSampleRate(m_deferredSampleRate);
+    _resetSampleRate(m_deferredSampleRate, false);
   if (m_setPitchRatio)
     _setPitchRatio(m_pitchRatio, m_slew);
 }
 
+void AudioVoice::_applyCommand(const AudioCommand& cmd) {
+  switch (cmd.m_type) {
+  case AudioCommandType::VoiceStart:
+    m_running = true;
+    break;
+  case AudioCommandType::VoiceStop:
+    m_running = false;
+    break;
+  case AudioCommandType::VoiceResetSampleRate:
+    m_resetSampleRate = true;
+    m_deferredSampleRate = cmd.m_value;
+    break;
+  case AudioCommandType::VoiceResamplerQuality:
+    m_quality = cmd.m_quality;
+    if (!m_resetSampleRate) {
+      m_resetSampleRate = true;
+      m_deferredSampleRate = m_sampleRateIn;
+    }
+    break;
+  case AudioCommandType::VoicePitchRatio:
+    m_setPitchRatio = true;
+    m_pitchRatio = cmd.m_value;
+    m_slew = cmd.m_slew;
+    break;
+  case AudioCommandType::VoiceResetChannelLevels:
+    _resetChannelLevels();
+    break;
+  case AudioCommandType::VoiceMonoChannelLevels:
+    _setMonoChannelLevels(cmd.m_send, cmd.m_monoCoefs, cmd.m_slew);
+    break;
+  case AudioCommandType::VoiceStereoChannelLevels:
+    _setStereoChannelLevels(cmd.m_send, cmd.m_stereoCoefs, cmd.m_slew);
+    break;
+  case AudioCommandType::VoicePriority:
+    m_priority = cmd.m_priority;
+    break;
+  default:
+    break;
+  }
+}
+
 void AudioVoice::setPitchRatio(double ratio, bool slew) {
-  m_setPitchRatio = true;
-  m_pitchRatio = ratio;
-  m_slew = slew;
+  AudioCommand cmd(AudioCommandType::VoicePitchRatio, this);
+  cmd.m_value = ratio;
+  cmd.m_slew = slew;
+  m_head->_submitCommand(cmd);
 }
 
 void AudioVoice::resetSampleRate(double sampleRate) {
-  m_resetSampleRate = true;
-  m_deferredSampleRate = sampleRate;
+  AudioCommand cmd(AudioCommandType::VoiceResetSampleRate, this);
+  cmd.m_value = sampleRate;
+  m_head->_submitCommand(cmd);
+}
+
+void AudioVoice::setResamplerQuality(AudioVoiceQuality quality) {
+  AudioCommand cmd(AudioCommandType::VoiceResamplerQuality, this);
+  cmd.m_quality = quality;
+  m_head->_submitCommand(cmd);
 }
 
-void AudioVoice::start() { m_running = true; }
+void AudioVoice::resetChannelLevels() {
+  AudioCommand cmd(AudioCommandType::VoiceResetChannelLevels, this);
+  m_head->_submitCommand(cmd);
+}
 
-void AudioVoice::stop() { m_running = false; }
+void AudioVoice::setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) {
+  AudioCommand cmd(AudioCommandType::VoiceMonoChannelLevels, this);
+  cmd.m_send = submix;
+  std::copy(coefs, coefs + 8, cmd.m_monoCoefs);
+  cmd.m_slew = slew;
+  m_head->_submitCommand(cmd);
+}
 
-AudioVoiceMono::AudioVoiceMono(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, double sampleRate, bool dynamicRate)
-: AudioVoice(root, cb, dynamicRate) {
-  _resetSampleRate(sampleRate);
+void AudioVoice::setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) {
+  AudioCommand cmd(AudioCommandType::VoiceStereoChannelLevels, this);
+  cmd.m_send = submix;
+  std::copy(&coefs[0][0], &coefs[0][0] + 16, &cmd.m_stereoCoefs[0][0]);
+  cmd.m_slew = slew;
+  m_head->_submitCommand(cmd);
 }
 
-void AudioVoiceMono::_resetSampleRate(double sampleRate) {
-  soxr_delete(m_src);
+void AudioVoice::setPriority(int priority) {
+  AudioCommand cmd(AudioCommandType::VoicePriority, this);
+  cmd.m_priority = priority;
+  m_head->_submitCommand(cmd);
+}
 
-  double rateOut = m_head->mixInfo().m_sampleRate;
-  soxr_datatype_t formatOut = m_head->mixInfo().m_sampleFormat;
-  soxr_io_spec_t ioSpec = soxr_io_spec(SOXR_INT16_I, formatOut);
-  soxr_quality_spec_t qSpec = soxr_quality_spec(SOXR_20_BITQ, m_dynamicRate ? SOXR_VR : 0);
+void AudioVoice::start() {
+  AudioCommand cmd(AudioCommandType::VoiceStart, this);
+  m_head->_submitCommand(cmd);
+}
 
-  soxr_error_t err;
-  m_src = soxr_create(sampleRate, rateOut, 1, &err, &ioSpec, &qSpec, nullptr);
+void AudioVoice::stop() {
+  AudioCommand cmd(AudioCommandType::VoiceStop, this);
+  m_head->_submitCommand(cmd);
+}
 
-  if (err) {
-    Log.report(logvisor::Fatal, FMT_STRING("unable to create soxr resampler: {}"), soxr_strerror(err));
-    m_resetSampleRate = false;
-    return;
+AudioVoiceMono::AudioVoiceMono(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, double sampleRate, bool dynamicRate,
+                               AudioVoiceQuality quality, AudioSourceFormat format)
+: AudioVoice(root, cb, 1, dynamicRate, quality, format) {
+  _resetSampleRate(sampleRate, true);
+}
+
+void AudioVoiceMono::_resetSampleRate(double sampleRate, bool wait) {
+  AudioResampler* resampler = nullptr;
+  if (!_isRateMatched(sampleRate)) {
+    resampler = _acquireResampler(sampleRate, 1, wait);
+    if (!resampler) {
+      m_resetSampleRate = !wait;
+      m_deferredSampleRate = sampleRate;
+      return;
+    }
+    soxr_input_fn_t inputFn = DispatchSource(
+        m_format, [](auto tag) { return soxr_input_fn_t(SRCCallback<typename decltype(tag)::Type>); });
+    soxr_set_input_fn(resampler->m_src, inputFn, this, 0);
   }
+  _releaseResampler();
+  m_resampler = resampler;
+
+  double rateOut = m_head->mixInfo().m_sampleRate;
 
   m_sampleRateIn = sampleRate;
   m_sampleRateOut = rateOut;
   m_sampleRatio = m_sampleRateIn / m_sampleRateOut;
-  soxr_set_input_fn(m_src, soxr_input_fn_t(SRCCallback), this, 0);
   _setPitchRatio(m_pitchRatio, false);
   m_resetSampleRate = false;
+  m_resamplerStale = false;
 }
 
-size_t AudioVoiceMono::SRCCallback(AudioVoiceMono* ctx, int16_t** data, size_t frames) {
-  std::vector<int16_t>& scratchIn = ctx->m_head->m_scratchIn;
+template <typename S>
+size_t AudioVoiceMono::SRCCallback(AudioVoiceMono* ctx, S** data, size_t frames) {
+  std::vector<S>& scratchIn = ctx->m_scratch->_getScratchIn<S>();
   if (scratchIn.size() < frames)
     scratchIn.resize(frames);
   *data = scratchIn.data();
   if (ctx->m_silentOut) {
-    memset(scratchIn.data(), 0, frames * 2);
+    memset(scratchIn.data(), 0, frames * sizeof(S));
     return frames;
   } else
     return ctx->m_cb->supplyAudio(*ctx, frames, scratchIn.data());
@@ -98,8 +319,8 @@ size_t AudioVoiceMono::SRCCallback(AudioVoiceMono* ctx, int16_t** data, size_t f
 
 bool AudioVoiceMono::isSilent() const {
   if (m_sendMatrices.size()) {
-    for (auto& mtx : m_sendMatrices)
-      if (!mtx.second.isSilent())
+    for (const auto& send : m_sendMatrices)
+      if (!send.m_value.isSilent())
         return false;
     return true;
   } else {
@@ -107,112 +328,149 @@ bool AudioVoiceMono::isSilent() const {
   }
 }
 
+float AudioVoiceMono::_audibility(size_t planSlot) const {
+  if (m_sendMatrices.empty())
+    return DefaultMonoMtx.peakCoefficient() * m_head->m_mainSubmix->m_audibility;
+
+  float audibility = 0.f;
+  for (const auto& send : m_sendMatrices) {
+    const AudioSubmix& smx = *reinterpret_cast<const AudioSubmix*>(send.m_submix);
+    if (smx.m_mixIdx[planSlot] >= 0)
+      audibility = std::max(audibility, send.m_value.peakCoefficient() * smx.m_audibility);
+  }
+  return audibility;
+}
+
 template <typename T>
-size_t AudioVoiceMono::_pumpAndMix(size_t frames) {
-  auto& scratchPre = m_head->_getScratchPre<T>();
+size_t AudioVoiceMono::_pumpAndMix(size_t frames, AudioMixScratch& scratch) {
+  m_scratch = &scratch;
+  auto& scratchPre = scratch._getScratchPre<T>();
   if (scratchPre.size() < frames)
     scratchPre.resize(frames + 2);
 
-  auto& scratchPost = m_head->_getScratchPost<T>();
+  auto& scratchPost = scratch._getScratchPost<T>();
   if (scratchPost.size() < frames)
     scratchPost.resize(frames + 2);
 
   double dt = frames / m_sampleRateOut;
-  m_cb->preSupplyAudio(*this, dt);
+  if (!m_head->m_preSupplyBatched)
+    m_cb->preSupplyAudio(*this, dt);
   _midUpdate();
 
-  if (isSilent()) {
-    int16_t* dummy;
-    SRCCallback(this, &dummy, size_t(std::ceil(frames * m_sampleRatio)));
+  /* Streaming voices start where the first fill lands rather than on padded silence */
+  if (!isPrimed())
+    return 0;
+
+  if (m_virtual || isSilent() || !_refreshResampler()) {
+    size_t srcFrames = _skipSourceFrames(frames);
+    if (!m_cb->skipAudio(*this, srcFrames)) {
+      DispatchSource(m_format, [&](auto tag) {
+        typename decltype(tag)::Type* dummy;
+        SRCCallback(this, &dummy, srcFrames);
+      });
+    }
     return 0;
   }
 
-  size_t oDone = soxr_output(m_src, scratchPre.data(), frames);
+  size_t oDone;
+  if (m_resampler) {
+    oDone = soxr_output(m_resampler->m_src, scratchPre.data(), frames);
+  } else {
+    oDone = DispatchSource(m_format, [&](auto tag) {
+      typename decltype(tag)::Type* in;
+      size_t done = SRCCallback(this, &in, frames);
+      ConvertSource(in, scratchPre.data(), done);
+      return done;
+    });
+  }
 
   if (oDone) {
     if (m_sendMatrices.size()) {
-      for (auto& mtx : m_sendMatrices) {
-        AudioSubmix& smx = *reinterpret_cast<AudioSubmix*>(mtx.first);
+      for (auto& send : m_sendMatrices) {
+        AudioSubmix& smx = *reinterpret_cast<AudioSubmix*>(send.m_submix);
         m_cb->routeAudio(oDone, 1, dt, smx.m_busId, scratchPre.data(), scratchPost.data());
-        mtx.second.mixMonoSampleData(m_head->clientMixInfo(), scratchPost.data(), smx._getMergeBuf<T>(oDone), oDone);
+        send.m_value.mixMonoSampleData(m_head->clientMixInfo(), scratchPost.data(),
+                                       scratch._getMergeBuf<T>(smx, oDone), oDone);
       }
     } else {
       AudioSubmix& smx = *m_head->m_mainSubmix;
       m_cb->routeAudio(oDone, 1, dt, m_head->m_mainSubmix->m_busId, scratchPre.data(), scratchPost.data());
-      DefaultMonoMtx.mixMonoSampleData(m_head->clientMixInfo(), scratchPost.data(), smx._getMergeBuf<T>(oDone), oDone);
+      DefaultMonoMtx.mixMonoSampleData(m_head->clientMixInfo(), scratchPost.data(), scratch._getMergeBuf<T>(smx, oDone),
+                                       oDone);
     }
   }
 
   return oDone;
 }
 
-void AudioVoiceMono::resetChannelLevels() {
-  m_head->m_submixesDirty = true;
+void AudioVoiceMono::_resetChannelLevels() {
   m_sendMatrices.clear();
 }
 
-void AudioVoiceMono::setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) {
+void AudioVoiceMono::_setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) {
   if (!submix)
     submix = m_head->m_mainSubmix.get();
 
-  auto search = m_sendMatrices.find(submix);
-  if (search == m_sendMatrices.cend())
-    search = m_sendMatrices.emplace(submix, AudioMatrixMono{}).first;
-  search->second.setMatrixCoefficients(coefs, slew ? m_head->m_5msFrames : 0);
+  auto* send = m_sendMatrices.find(submix);
+  if (!send)
+    send = &m_sendMatrices.emplace(submix);
+  send->m_value.setMatrixCoefficients(coefs, slew ? m_head->m_5msFrames : 0);
 }
 
-void AudioVoiceMono::setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) {
+void AudioVoiceMono::_setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) {
   float newCoefs[8] = {coefs[0][0], coefs[1][0], coefs[2][0], coefs[3][0],
                        coefs[4][0], coefs[5][0], coefs[6][0], coefs[7][0]};
 
   if (!submix)
     submix = m_head->m_mainSubmix.get();
 
-  auto search = m_sendMatrices.find(submix);
-  if (search == m_sendMatrices.cend())
-    search = m_sendMatrices.emplace(submix, AudioMatrixMono{}).first;
-  search->second.setMatrixCoefficients(newCoefs, slew ? m_head->m_5msFrames : 0);
+  auto* send = m_sendMatrices.find(submix);
+  if (!send)
+    send = &m_sendMatrices.emplace(submix);
+  send->m_value.setMatrixCoefficients(newCoefs, slew ? m_head->m_5msFrames : 0);
 }
 
 AudioVoiceStereo::AudioVoiceStereo(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, double sampleRate,
-                                   bool dynamicRate)
-: AudioVoice(root, cb, dynamicRate) {
-  _resetSampleRate(sampleRate);
+                                   bool dynamicRate, AudioVoiceQuality quality, AudioSourceFormat format)
+: AudioVoice(root, cb, 2, dynamicRate, quality, format) {
+  _resetSampleRate(sampleRate, true);
 }
 
-void AudioVoiceStereo::_resetSampleRate(double sampleRate) {
-  soxr_delete(m_src);
+void AudioVoiceStereo::_resetSampleRate(double sampleRate, bool wait) {
+  AudioResampler* resampler = nullptr;
+  if (!_isRateMatched(sampleRate)) {
+    resampler = _acquireResampler(sampleRate, 2, wait);
+    if (!resampler) {
+      m_resetSampleRate = !wait;
+      m_deferredSampleRate = sampleRate;
+      return;
+    }
+    soxr_input_fn_t inputFn = DispatchSource(
+        m_format, [](auto tag) { return soxr_input_fn_t(SRCCallback<typename decltype(tag)::Type>); });
+    soxr_set_input_fn(resampler->m_src, inputFn, this, 0);
+  }
+  _releaseResampler();
+  m_resampler = resampler;
 
   double rateOut = m_head->mixInfo().m_sampleRate;
-  soxr_datatype_t formatOut = m_head->mixInfo().m_sampleFormat;
-  soxr_io_spec_t ioSpec = soxr_io_spec(SOXR_INT16_I, formatOut);
-  soxr_quality_spec_t qSpec = soxr_quality_spec(SOXR_20_BITQ, m_dynamicRate ? SOXR_VR : 0);
-
-  soxr_error_t err;
-  m_src = soxr_create(sampleRate, rateOut, 2, &err, &ioSpec, &qSpec, nullptr);
-
-  if (!m_src) {
-    Log.report(logvisor::Fatal, FMT_STRING("unable to create soxr resampler: {}"), soxr_strerror(err));
-    m_resetSampleRate = false;
-    return;
-  }
 
   m_sampleRateIn = sampleRate;
   m_sampleRateOut = rateOut;
   m_sampleRatio = m_sampleRateIn / m_sampleRateOut;
-  soxr_set_input_fn(m_src, soxr_input_fn_t(SRCCallback), this, 0);
   _setPitchRatio(m_pitchRatio, false);
   m_resetSampleRate = false;
+  m_resamplerStale = false;
 }
 
-size_t AudioVoiceStereo::SRCCallback(AudioVoiceStereo* ctx, int16_t** data, size_t frames) {
-  std::vector<int16_t>& scratchIn = ctx->m_head->m_scratchIn;
+template <typename S>
+size_t AudioVoiceStereo::SRCCallback(AudioVoiceStereo* ctx, S** data, size_t frames) {
+  std::vector<S>& scratchIn = ctx->m_scratch->_getScratchIn<S>();
   size_t samples = frames * 2;
   if (scratchIn.size() < samples)
     scratchIn.resize(samples);
   *data = scratchIn.data();
   if (ctx->m_silentOut) {
-    memset(scratchIn.data(), 0, samples * 2);
+    memset(scratchIn.data(), 0, samples * sizeof(S));
     return frames;
   } else
     return ctx->m_cb->supplyAudio(*ctx, frames, scratchIn.data());
@@ -220,8 +478,8 @@ size_t AudioVoiceStereo::SRCCallback(AudioVoiceStereo* ctx, int16_t** data, size
 
 bool AudioVoiceStereo::isSilent() const {
   if (m_sendMatrices.size()) {
-    for (auto& mtx : m_sendMatrices)
-      if (!mtx.second.isSilent())
+    for (const auto& send : m_sendMatrices)
+      if (!send.m_value.isSilent())
         return false;
     return true;
   } else {
@@ -229,74 +487,108 @@ bool AudioVoiceStereo::isSilent() const {
   }
 }
 
+float AudioVoiceStereo::_audibility(size_t planSlot) const {
+  if (m_sendMatrices.empty())
+    return DefaultStereoMtx.peakCoefficient() * m_head->m_mainSubmix->m_audibility;
+
+  float audibility = 0.f;
+  for (const auto& send : m_sendMatrices) {
+    const AudioSubmix& smx = *reinterpret_cast<const AudioSubmix*>(send.m_submix);
+    if (smx.m_mixIdx[planSlot] >= 0)
+      audibility = std::max(audibility, send.m_value.peakCoefficient() * smx.m_audibility);
+  }
+  return audibility;
+}
+
 template <typename T>
-size_t AudioVoiceStereo::_pumpAndMix(size_t frames) {
+size_t AudioVoiceStereo::_pumpAndMix(size_t frames, AudioMixScratch& scratch) {
+  m_scratch = &scratch;
   size_t samples = frames * 2;
 
-  auto& scratchPre = m_head->_getScratchPre<T>();
+  auto& scratchPre = scratch._getScratchPre<T>();
   if (scratchPre.size() < samples)
     scratchPre.resize(samples + 4);
 
-  auto& scratchPost = m_head->_getScratchPost<T>();
+  auto& scratchPost = scratch._getScratchPost<T>();
   if (scratchPost.size() < samples)
     scratchPost.resize(samples + 4);
 
   double dt = frames / m_sampleRateOut;
-  m_cb->preSupplyAudio(*this, dt);
+  if (!m_head->m_preSupplyBatched)
+    m_cb->preSupplyAudio(*this, dt);
   _midUpdate();
 
-  if (isSilent()) {
-    int16_t* dummy;
-    SRCCallback(this, &dummy, size_t(std::ceil(frames * m_sampleRatio)));
+  /* Streaming voices start where the first fill lands rather than on padded silence */
+  if (!isPrimed())
+    return 0;
+
+  if (m_virtual || isSilent() || !_refreshResampler()) {
+    size_t srcFrames = _skipSourceFrames(frames);
+    if (!m_cb->skipAudio(*this, srcFrames)) {
+      DispatchSource(m_format, [&](auto tag) {
+        typename decltype(tag)::Type* dummy;
+        SRCCallback(this, &dummy, srcFrames);
+      });
+    }
     return 0;
   }
 
-  size_t oDone = soxr_output(m_src, scratchPre.data(), frames);
+  size_t oDone;
+  if (m_resampler) {
+    oDone = soxr_output(m_resampler->m_src, scratchPre.data(), frames);
+  } else {
+    oDone = DispatchSource(m_format, [&](auto tag) {
+      typename decltype(tag)::Type* in;
+      size_t done = SRCCallback(this, &in, frames);
+      ConvertSource(in, scratchPre.data(), done * 2);
+      return done;
+    });
+  }
 
   if (oDone) {
     if (m_sendMatrices.size()) {
-      for (auto& mtx : m_sendMatrices) {
-        AudioSubmix& smx = *reinterpret_cast<AudioSubmix*>(mtx.first);
+      for (auto& send : m_sendMatrices) {
+        AudioSubmix& smx = *reinterpret_cast<AudioSubmix*>(send.m_submix);
         m_cb->routeAudio(oDone, 2, dt, smx.m_busId, scratchPre.data(), scratchPost.data());
-        mtx.second.mixStereoSampleData(m_head->clientMixInfo(), scratchPost.data(), smx._getMergeBuf<T>(oDone), oDone);
+        send.m_value.mixStereoSampleData(m_head->clientMixInfo(), scratchPost.data(),
+                                         scratch._getMergeBuf<T>(smx, oDone), oDone);
       }
     } else {
       AudioSubmix& smx = *m_head->m_mainSubmix;
       m_cb->routeAudio(oDone, 2, dt, m_head->m_mainSubmix->m_busId, scratchPre.data(), scratchPost.data());
-      DefaultStereoMtx.mixStereoSampleData(m_head->clientMixInfo(), scratchPost.data(), smx._getMergeBuf<T>(oDone),
-                                           oDone);
+      DefaultStereoMtx.mixStereoSampleData(m_head->clientMixInfo(), scratchPost.data(),
+                                           scratch._getMergeBuf<T>(smx, oDone), oDone);
     }
   }
 
   return oDone;
 }
 
-void AudioVoiceStereo::resetChannelLevels() {
-  m_head->m_submixesDirty = true;
+void AudioVoiceStereo::_resetChannelLevels() {
   m_sendMatrices.clear();
 }
 
-void AudioVoiceStereo::setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) {
+void AudioVoiceStereo::_setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) {
   float newCoefs[8][2] = {{coefs[0], coefs[0]}, {coefs[1], coefs[1]}, {coefs[2], coefs[2]}, {coefs[3], coefs[3]},
                           {coefs[4], coefs[4]}, {coefs[5], coefs[5]}, {coefs[6], coefs[6]}, {coefs[7], coefs[7]}};
 
   if (!submix)
     submix = m_head->m_mainSubmix.get();
 
-  auto search = m_sendMatrices.find(submix);
-  if (search == m_sendMatrices.cend())
-    search = m_sendMatrices.emplace(submix, AudioMatrixStereo{}).first;
-  search->second.setMatrixCoefficients(newCoefs, slew ? m_head->m_5msFrames : 0);
+  auto* send = m_sendMatrices.find(submix);
+  if (!send)
+    send = &m_sendMatrices.emplace(submix);
+  send->m_value.setMatrixCoefficients(newCoefs, slew ? m_head->m_5msFrames : 0);
 }
 
-void AudioVoiceStereo::setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) {
+void AudioVoiceStereo::_setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) {
   if (!submix)
     submix = m_head->m_mainSubmix.get();
 
-  auto search = m_sendMatrices.find(submix);
-  if (search == m_sendMatrices.cend())
-    search = m_sendMatrices.emplace(submix, AudioMatrixStereo{}).first;
-  search->second.setMatrixCoefficients(coefs, slew ? m_head->m_5msFrames : 0);
+  auto* send = m_sendMatrices.find(submix);
+  if (!send)
+    send = &m_sendMatrices.emplace(submix);
+  send->m_value.setMatrixCoefficients(coefs, slew ? m_head->m_5msFrames : 0);
 }
 
 } // namespace boo
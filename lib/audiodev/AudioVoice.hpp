@@ -1,10 +1,11 @@
 #pragma once
 
 #include <mutex>
-#include <unordered_map>
 
 #include "boo/audiodev/IAudioVoice.hpp"
 #include "lib/audiodev/AudioMatrix.hpp"
+#include "lib/audiodev/AudioResamplerPool.hpp"
+#include "lib/audiodev/AudioStream.hpp"
 #include "lib/audiodev/AudioVoiceEngine.hpp"
 #include "lib/audiodev/Common.hpp"
 
@@ -16,6 +17,8 @@ struct WAVOutVoiceEngine;
 
 namespace boo {
 class BaseAudioVoiceEngine;
+struct AudioCommand;
+struct AudioMixScratch;
 struct AudioVoiceEngineMixInfo;
 struct IAudioSubmix;
 
@@ -31,19 +34,48 @@ protected:
   /* Callback (audio source) */
   IAudioVoiceCallback* m_cb;
 
-  /* Sample-rate converter */
-  soxr_t m_src = nullptr;
+  /* Prefetch ring serving as m_cb of streaming voices */
+  std::shared_ptr<AudioStream> m_stream;
+
+  /* Sample-rate converter (null while rate-matched voices pass audio straight through) */
+  AudioResampler* m_resampler = nullptr;
   double m_sampleRateIn;
   double m_sampleRateOut;
   bool m_dynamicRate;
+  AudioVoiceQuality m_quality;
+  AudioSourceFormat m_format;
+  unsigned m_channelCount;
 
   /* Running bool */
   bool m_running = false;
 
-  /* Deferred sample-rate reset */
+  /* Real-voice budget ranking; virtual voices advance their source without resampling or mixing */
+  int m_priority = 0;
+  bool m_virtual = false;
+
+  /* Loudest gain from this voice to the main output through sends routed in the specified mix plan */
+  virtual float _audibility(size_t planSlot) const = 0;
+
+  /* Scratch of the mixing thread currently pumping this voice */
+  AudioMixScratch* m_scratch = nullptr;
+
+  /* Deferred sample-rate reset; mixing threads do not wait for a resampler, so a reset stays pending
+   * (mixing through the previous resampler, if any) until the pool has one for the new rate */
   bool m_resetSampleRate = false;
   double m_deferredSampleRate;
-  virtual void _resetSampleRate(double sampleRate) = 0;
+  virtual void _resetSampleRate(double sampleRate, bool wait) = 0;
+  bool _isRateMatched(double sampleRate) const;
+  AudioResampler* _acquireResampler(double sampleRate, unsigned channels, bool wait);
+  void _releaseResampler();
+
+  /* Skipped (silent or virtual) quanta advance the source without the resampler, leaving it holding stale
+   * input; mixing resumes through a cleared one from the pool, skipping further quanta until there is one */
+  bool m_resamplerStale = false;
+  bool _refreshResampler();
+
+  /* Source frames owed to the callback for the quanta skipped so far, carried so the position stays exact */
+  double m_skipRemainder = 0.0;
+  size_t _skipSourceFrames(size_t frames);
 
   /* Deferred pitch ratio set */
   bool m_setPitchRatio = false;
@@ -55,13 +87,20 @@ protected:
   /* Mid-pump update */
   void _midUpdate();
 
-  virtual size_t pumpAndMix16(size_t frames) = 0;
-  virtual size_t pumpAndMix32(size_t frames) = 0;
-  virtual size_t pumpAndMixFlt(size_t frames) = 0;
+  /* Parameter changes, applied on the pumping thread */
+  void _applyCommand(const AudioCommand& cmd);
+  virtual void _resetChannelLevels() = 0;
+  virtual void _setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) = 0;
+  virtual void _setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) = 0;
+
+  virtual size_t pumpAndMix16(size_t frames, AudioMixScratch& scratch) = 0;
+  virtual size_t pumpAndMix32(size_t frames, AudioMixScratch& scratch) = 0;
+  virtual size_t pumpAndMixFlt(size_t frames, AudioMixScratch& scratch) = 0;
   template <typename T>
-  size_t pumpAndMix(size_t frames);
+  size_t pumpAndMix(size_t frames, AudioMixScratch& scratch);
 
-  AudioVoice(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, bool dynamicRate);
+  AudioVoice(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, unsigned channelCount, bool dynamicRate,
+             AudioVoiceQuality quality, AudioSourceFormat format);
 
 public:
   static AudioVoice*& _getHeadPtr(BaseAudioVoiceEngine* head);
@@ -69,68 +108,94 @@ public:
 
   ~AudioVoice() override;
   void resetSampleRate(double sampleRate) override;
+  void setResamplerQuality(AudioVoiceQuality quality) override;
+  void resetChannelLevels() override;
+  void setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) override;
+  void setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) override;
   void setPitchRatio(double ratio, bool slew) override;
+  void setPriority(int priority) override;
   void start() override;
   void stop() override;
+  bool isPrimed() const override { return !m_stream || m_stream->primed(); }
   double getSampleRateIn() const { return m_sampleRateIn; }
   double getSampleRateOut() const { return m_sampleRateOut; }
 };
 
 template <>
-inline size_t AudioVoice::pumpAndMix<int16_t>(size_t frames) {
-  return pumpAndMix16(frames);
+inline size_t AudioVoice::pumpAndMix<int16_t>(size_t frames, AudioMixScratch& scratch) {
+  return pumpAndMix16(frames, scratch);
 }
 template <>
-inline size_t AudioVoice::pumpAndMix<int32_t>(size_t frames) {
-  return pumpAndMix32(frames);
+inline size_t AudioVoice::pumpAndMix<int32_t>(size_t frames, AudioMixScratch& scratch) {
+  return pumpAndMix32(frames, scratch);
 }
 template <>
-inline size_t AudioVoice::pumpAndMix<float>(size_t frames) {
-  return pumpAndMixFlt(frames);
+inline size_t AudioVoice::pumpAndMix<float>(size_t frames, AudioMixScratch& scratch) {
+  return pumpAndMixFlt(frames, scratch);
 }
 
 class AudioVoiceMono : public AudioVoice {
-  std::unordered_map<IAudioSubmix*, AudioMatrixMono> m_sendMatrices;
+  SendTable<AudioMatrixMono> m_sendMatrices;
   bool m_silentOut = false;
-  void _resetSampleRate(double sampleRate) override;
+  void _resetSampleRate(double sampleRate, bool wait) override;
 
-  static size_t SRCCallback(AudioVoiceMono* ctx, int16_t** data, size_t requestedLen);
+  template <typename S>
+  static size_t SRCCallback(AudioVoiceMono* ctx, S** data, size_t requestedLen);
 
   bool isSilent() const;
+  float _audibility(size_t planSlot) const override;
 
   template <typename T>
-  size_t _pumpAndMix(size_t frames);
-  size_t pumpAndMix16(size_t frames) override { return _pumpAndMix<int16_t>(frames); }
-  size_t pumpAndMix32(size_t frames) override { return _pumpAndMix<int32_t>(frames); }
-  size_t pumpAndMixFlt(size_t frames) override { return _pumpAndMix<float>(frames); }
+  size_t _pumpAndMix(size_t frames, AudioMixScratch& scratch);
+  size_t pumpAndMix16(size_t frames, AudioMixScratch& scratch) override {
+    return _pumpAndMix<int16_t>(frames, scratch);
+  }
+  size_t pumpAndMix32(size_t frames, AudioMixScratch& scratch) override {
+    return _pumpAndMix<int32_t>(frames, scratch);
+  }
+  size_t pumpAndMixFlt(size_t frames, AudioMixScratch& scratch) override {
+    return _pumpAndMix<float>(frames, scratch);
+  }
+
+  void _resetChannelLevels() override;
+  void _setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) override;
+  void _setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) override;
 
 public:
-  AudioVoiceMono(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, double sampleRate, bool dynamicRate);
-  void resetChannelLevels() override;
-  void setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) override;
-  void setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) override;
+  AudioVoiceMono(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, double sampleRate, bool dynamicRate,
+                 AudioVoiceQuality quality, AudioSourceFormat format);
 };
 
 class AudioVoiceStereo : public AudioVoice {
-  std::unordered_map<IAudioSubmix*, AudioMatrixStereo> m_sendMatrices;
+  SendTable<AudioMatrixStereo> m_sendMatrices;
   bool m_silentOut = false;
-  void _resetSampleRate(double sampleRate) override;
+  void _resetSampleRate(double sampleRate, bool wait) override;
 
-  static size_t SRCCallback(AudioVoiceStereo* ctx, int16_t** data, size_t requestedLen);
+  template <typename S>
+  static size_t SRCCallback(AudioVoiceStereo* ctx, S** data, size_t requestedLen);
 
   bool isSilent() const;
+  float _audibility(size_t planSlot) const override;
 
   template <typename T>
-  size_t _pumpAndMix(size_t frames);
-  size_t pumpAndMix16(size_t frames) override { return _pumpAndMix<int16_t>(frames); }
-  size_t pumpAndMix32(size_t frames) override { return _pumpAndMix<int32_t>(frames); }
-  size_t pumpAndMixFlt(size_t frames) override { return _pumpAndMix<float>(frames); }
+  size_t _pumpAndMix(size_t frames, AudioMixScratch& scratch);
+  size_t pumpAndMix16(size_t frames, AudioMixScratch& scratch) override {
+    return _pumpAndMix<int16_t>(frames, scratch);
+  }
+  size_t pumpAndMix32(size_t frames, AudioMixScratch& scratch) override {
+    return _pumpAndMix<int32_t>(frames, scratch);
+  }
+  size_t pumpAndMixFlt(size_t frames, AudioMixScratch& scratch) override {
+    return _pumpAndMix<float>(frames, scratch);
+  }
+
+  void _resetChannelLevels() override;
+  void _setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) override;
+  void _setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) override;
 
 public:
-  AudioVoiceStereo(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, double sampleRate, bool dynamicRate);
-  void resetChannelLevels() override;
-  void setMonoChannelLevels(IAudioSubmix* submix, const float coefs[8], bool slew) override;
-  void setStereoChannelLevels(IAudioSubmix* submix, const float coefs[8][2], bool slew) override;
+  AudioVoiceStereo(BaseAudioVoiceEngine& root, IAudioVoiceCallback* cb, double sampleRate, bool dynamicRate,
+                   AudioVoiceQuality quality, AudioSourceFormat format);
 };
 
 } // namespace boo
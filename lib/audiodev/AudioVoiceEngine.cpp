@@ -1,11 +1,101 @@
 #include "lib/audiodev/AudioVoiceEngine.hpp"
 
+#include "lib/audiodev/AudioPanning.hpp"
+
+#include <algorithm>
 #include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
 #include <cstring>
+#include <type_traits>
+
+#include <logvisor/logvisor.hpp>
+#include <optick.h>
 
 namespace boo {
+static logvisor::Module Log("boo::AudioVoiceEngine");
+
+/* Set on the thread owning the current quantum, except while mixing threads pump voices in parallel;
+ * parameter changes made from its callbacks apply immediately */
+static thread_local bool t_mixThread = false;
+
+/* Voice the calling thread is pumping; changes to it from its own callbacks also apply immediately */
+static thread_local AudioVoice* t_mixVoice = nullptr;
+
+/* Real voices keep their slot against virtual ones up to this much (about 2dB) louder,
+ * so voices at the edge of the budget do not flip between real and virtual every quantum */
+constexpr float VirtualVoiceHysteresis = 1.25f;
+
+using StatsClock = std::chrono::steady_clock;
+
+static double StatsSeconds(StatsClock::time_point begin, StatsClock::time_point end) {
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+void AudioPumpStats::_addPump(double seconds) {
+  size_t bucket = size_t(std::log2(1.0 + seconds * 1.0e6) * BucketsPerOctave);
+  ++m_histogram[std::min(bucket, HistogramBuckets - 1)];
+  m_pumpMin = m_pumps ? std::min(m_pumpMin, seconds) : seconds;
+  m_pumpMax = std::max(m_pumpMax, seconds);
+  m_pumpTotal += seconds;
+  ++m_pumps;
+}
+
+double AudioPumpStats::_percentile(double fraction) const {
+  size_t target = std::max(size_t(std::ceil(fraction * m_pumps)), size_t(1));
+  size_t seen = 0;
+  for (size_t b = 0; b < HistogramBuckets - 1; ++b) {
+    seen += m_histogram[b];
+    if (seen >= target)
+      return std::min((std::exp2(double(b + 1) / BucketsPerOctave) - 1.0) / 1.0e6, m_pumpMax);
+  }
+  return m_pumpMax;
+}
+
+void AudioMixScratch::_beginMerge(const AudioMixPlan& plan, size_t stride) {
+  m_mergeStride = stride;
+  m_planSlot = plan.m_slot;
+  m_mergeUsed.assign(plan.m_order.size() + 1, 0);
+}
+
+template <typename T>
+T* AudioMixScratch::_getMergeBuf(AudioSubmix& smx, size_t frames) {
+  if (m_threadIdx == 0)
+    return smx._getMergeBuf<T>(frames);
+
+  int mixIdx = smx.m_mixIdx[m_planSlot];
+  size_t slot = mixIdx < 0 ? m_mergeUsed.size() - 1 : size_t(mixIdx);
+  std::vector<T>& merge = _getMerge<T>();
+  if (merge.size() < m_mergeUsed.size() * m_mergeStride)
+    merge.resize(m_mergeUsed.size() * m_mergeStride);
+
+  T* ret = merge.data() + slot * m_mergeStride;
+  if (!m_mergeUsed[slot]) {
+    std::fill(ret, ret + m_mergeStride, 0);
+    m_mergeUsed[slot] = 1;
+  }
+  return ret;
+}
+
+template int16_t* AudioMixScratch::_getMergeBuf<int16_t>(AudioSubmix& smx, size_t frames);
+template int32_t* AudioMixScratch::_getMergeBuf<int32_t>(AudioSubmix& smx, size_t frames);
+template float* AudioMixScratch::_getMergeBuf<float>(AudioSubmix& smx, size_t frames);
+
+template <typename T>
+void AudioMixScratch::_reduceInto(AudioSubmix& smx, size_t frames) {
+  int mixIdx = smx.m_mixIdx[m_planSlot];
+  if (mixIdx < 0 || !m_mergeUsed[mixIdx])
+    return;
+  smx._mergeFrom<T>(_getMerge<T>().data() + mixIdx * m_mergeStride, frames);
+}
+
+template void AudioMixScratch::_reduceInto<int16_t>(AudioSubmix& smx, size_t frames);
+template void AudioMixScratch::_reduceInto<int32_t>(AudioSubmix& smx, size_t frames);
+template void AudioMixScratch::_reduceInto<float>(AudioSubmix& smx, size_t frames);
 
 BaseAudioVoiceEngine::~BaseAudioVoiceEngine() {
+  _stopMixThreads();
   m_mainSubmix.reset();
   assert(m_voiceHead == nullptr && "Dangling voices detected");
   assert(m_submixHead == nullptr && "Dangling submixes detected");
@@ -13,113 +103,717 @@ BaseAudioVoiceEngine::~BaseAudioVoiceEngine() {
 
 template <typename T>
 void BaseAudioVoiceEngine::_pumpAndMixVoices(size_t frames, T* dataOut) {
-  if (dataOut)
-    memset(dataOut, 0, sizeof(T) * frames * m_mixInfo.m_channelMap.m_channelCount);
+  if constexpr (!std::is_same_v<T, float>) {
+    if (m_floatMix) {
+      _pumpAndMixBus<float>(frames, dataOut);
+      return;
+    }
+  }
+  _pumpAndMixBus<T>(frames, dataOut);
+}
 
-  if (m_ltRtProcessing) {
-    size_t sampleCount = m_5msFrames * 5;
-    if (_getLtRtIn<T>().size() < sampleCount)
-      _getLtRtIn<T>().resize(sampleCount);
-    m_mainSubmix->_getRedirect<T>() = _getLtRtIn<T>().data();
-  } else {
-    m_mainSubmix->_getRedirect<T>() = dataOut;
+/* Mixes the graph in bus format B and delivers each quantum to dataOut in device format T */
+template <typename B, typename T>
+void BaseAudioVoiceEngine::_pumpAndMixBus(size_t frames, T* dataOut) {
+  struct MixThreadScope {
+    bool m_prev = t_mixThread;
+    MixThreadScope() { t_mixThread = true; }
+    ~MixThreadScope() { t_mixThread = m_prev; }
+  } mixThreadScope;
+  StatsClock::time_point pumpStart = StatsClock::now();
+  if (m_statsReset.exchange(false, std::memory_order_acquire)) {
+    /* Latency is a current reading rather than an accumulation; keep it across resets */
+    double deviceLatency = m_pumpStats.m_deviceLatency;
+    m_pumpStats = AudioPumpStats();
+    m_pumpStats.m_deviceLatency = deviceLatency;
   }
 
-  if (m_submixesDirty) {
-    m_linearizedSubmixes = m_mainSubmix->_linearizeC3();
-    m_submixesDirty = false;
+  const size_t chanCount = m_mixInfo.m_channelMap.m_channelCount;
+  if constexpr (std::is_same_v<B, T>) {
+    if (dataOut)
+      memset(dataOut, 0, sizeof(T) * frames * chanCount);
   }
 
   size_t remFrames = frames;
   while (remFrames) {
-    size_t thisFrames;
-    if (remFrames < m_5msFrames) {
-      thisFrames = remFrames;
-      if (m_engineCallback)
-        m_engineCallback->on5MsInterval(*this, thisFrames / double(m_5msFrames) * 5.0 / 1000.0);
+    /* Commands posted before this quantum began take effect here, ahead of the engine callback */
+    size_t quantum = m_mixQuantum.load(std::memory_order_relaxed) + 1;
+    m_mixQuantum.store(quantum, std::memory_order_relaxed);
+    if (!m_commandQueue.empty() || m_commandOverflowed.load(std::memory_order_acquire) ||
+        m_topologyDeferred.load(std::memory_order_relaxed)) {
+      std::unique_lock lk(m_commandMutex, std::try_to_lock);
+      if (lk)
+        _drainCommands(quantum);
+    }
+
+    size_t thisFrames = std::min(remFrames, _quantumFrames());
+    B* busOut;
+    if constexpr (std::is_same_v<B, T>) {
+      busOut = dataOut;
     } else {
-      thisFrames = m_5msFrames;
-      if (m_engineCallback)
-        m_engineCallback->on5MsInterval(*this, 5.0 / 1000.0);
+      if (m_floatBus.size() < thisFrames * chanCount)
+        m_floatBus.resize(thisFrames * chanCount);
+      busOut = dataOut ? m_floatBus.data() : nullptr;
+      if (busOut)
+        memset(busOut, 0, sizeof(B) * thisFrames * chanCount);
     }
 
-    if (m_ltRtProcessing)
-      std::fill(_getLtRtIn<T>().begin(), _getLtRtIn<T>().end(), 0.f);
+    if (m_ltRtProcessing) {
+      /* The main submix mixes in place into the encoder's window ring; quanta may neither straddle a window
+       * nor exceed half of one */
+      thisFrames = std::min(thisFrames, size_t(m_ltRtProcessing->ContiguousFrames()));
+      m_mainSubmix->_getRedirect<B>() = m_ltRtProcessing->PrepareInput<B>(int(thisFrames));
+    } else {
+      m_mainSubmix->_getRedirect<B>() = busOut;
+    }
+
+    if (m_engineCallback)
+      m_engineCallback->on5MsInterval(*this, thisFrames / double(m_5msFrames) * 5.0 / 1000.0);
+
+    /* Topology changes made so far (including from the 5ms callback) take effect here */
+    const AudioMixPlan& plan = _acquireMixPlan();
+
+    for (AudioSubmix* smx : plan.m_order)
+      smx->_zeroFill<B>();
 
-    for (auto it = m_linearizedSubmixes.rbegin(); it != m_linearizedSubmixes.rend(); ++it)
-      (*it)->_zeroFill<T>();
+    StatsClock::time_point voiceStart = StatsClock::now();
+    _pumpVoices<B>(thisFrames);
 
-    if (m_voiceHead)
-      for (AudioVoice& vox : *m_voiceHead)
-        if (vox.m_running)
-          vox.pumpAndMix<T>(thisFrames);
+    StatsClock::time_point submixStart = StatsClock::now();
+    for (size_t i = 0; i < plan.m_order.size(); ++i)
+      plan.m_order[i]->_pumpAndMix<B>(thisFrames, plan, i);
 
-    for (auto it = m_linearizedSubmixes.rbegin(); it != m_linearizedSubmixes.rend(); ++it)
-      (*it)->_pumpAndMix<T>(thisFrames);
+    StatsClock::time_point submixEnd = StatsClock::now();
+    m_pumpStats.m_voiceTotal += StatsSeconds(voiceStart, submixStart);
+    m_pumpStats.m_submixTotal += StatsSeconds(submixStart, submixEnd);
 
     remFrames -= thisFrames;
     if (!dataOut)
       continue;
 
     if (m_ltRtProcessing) {
-      m_ltRtProcessing->Process(_getLtRtIn<T>().data(), dataOut, int(thisFrames));
-      m_mainSubmix->_getRedirect<T>() = _getLtRtIn<T>().data();
+      m_ltRtProcessing->Process(busOut, int(thisFrames));
+      m_pumpStats.m_ltRtTotal += StatsSeconds(submixEnd, StatsClock::now());
     }
 
-    size_t sampleCount = thisFrames * m_mixInfo.m_channelMap.m_channelCount;
-    for (size_t i = 0; i < sampleCount; ++i)
-      dataOut[i] *= m_totalVol;
+    size_t sampleCount = thisFrames * chanCount;
+    if constexpr (std::is_same_v<B, T>) {
+      for (size_t i = 0; i < sampleCount; ++i)
+        dataOut[i] *= m_totalVol;
+    } else {
+      /* The only conversion and clip of the quantum, folded together with the master volume */
+      if constexpr (std::is_same_v<T, int16_t>)
+        ConvertToInt16(busOut, dataOut, sampleCount, m_totalVol, m_floatMixDither ? &m_ditherState : nullptr);
+      else
+        ConvertToInt32(busOut, dataOut, sampleCount, m_totalVol);
+    }
 
     dataOut += sampleCount;
   }
 
   if (m_engineCallback)
     m_engineCallback->onPumpCycleComplete(*this);
+
+  double pumpSeconds = StatsSeconds(pumpStart, StatsClock::now());
+  m_pumpStats._addPump(pumpSeconds);
+  _publishStats();
+
+  OPTICK_TAG("Pump ms", float(pumpSeconds * 1000.0));
+  OPTICK_TAG("Active voices", uint32_t(m_pumpStats.m_activeVoices));
+  OPTICK_TAG("Silent voices", uint32_t(m_pumpStats.m_silentVoices));
+  OPTICK_TAG("Virtual voices", uint32_t(m_pumpStats.m_virtualVoices));
+}
+
+size_t BaseAudioVoiceEngine::_cullVoices(const AudioMixPlan& plan) {
+  /* Every submix precedes the submixes it sends to, so walking the plan backwards
+   * resolves the audibility of each send target before the submixes feeding it */
+  for (size_t i = plan.m_order.size(); i-- > 0;) {
+    AudioSubmix& smx = *plan.m_order[i];
+    if (&smx == m_mainSubmix.get()) {
+      smx.m_audibility = 1.f;
+      continue;
+    }
+    smx.m_audibility = 0.f;
+    for (size_t s = plan.m_sendBegin[i]; s < plan.m_sendBegin[i + 1]; ++s) {
+      const AudioMixPlan::Send& send = plan.m_sends[s];
+      float gain = smx.m_sendGains.begin()[send.m_gains].m_value[1];
+      smx.m_audibility = std::max(smx.m_audibility, std::fabs(gain) * plan.m_order[send.m_target]->m_audibility);
+    }
+  }
+
+  m_voiceRanks.clear();
+  for (AudioVoice& vox : *m_voiceHead) {
+    bool wasVirtual = vox.m_virtual;
+    vox.m_virtual = false;
+    if (!vox.m_running)
+      continue;
+    /* Silent voices skip mixing by themselves and do not take a slot */
+    float audibility = vox._audibility(plan.m_slot);
+    if (audibility <= FLT_EPSILON)
+      continue;
+    if (!wasVirtual)
+      audibility *= VirtualVoiceHysteresis;
+    m_voiceRanks.push_back({vox.m_priority, audibility, &vox});
+  }
+
+  if (m_voiceRanks.size() <= m_voiceBudget)
+    return 0;
+  auto budgetEnd = m_voiceRanks.begin() + m_voiceBudget;
+  std::nth_element(m_voiceRanks.begin(), budgetEnd, m_voiceRanks.end(),
+                   [](const AudioVoiceRank& a, const AudioVoiceRank& b) {
+                     if (a.m_priority != b.m_priority)
+                       return a.m_priority > b.m_priority;
+                     return a.m_audibility > b.m_audibility;
+                   });
+  for (auto it = budgetEnd; it != m_voiceRanks.end(); ++it)
+    it->m_voice->m_virtual = true;
+  return m_voiceRanks.size() - m_voiceBudget;
+}
+
+template <typename T>
+void BaseAudioVoiceEngine::_pumpVoices(size_t frames) {
+  size_t totalVoices = 0;
+  size_t virtualVoices = 0;
+  if (m_voiceBudget && m_voiceHead)
+    virtualVoices = _cullVoices(m_mixPlans[m_mixPlanFront]);
+  m_pumpStats.m_virtualVoices = virtualVoices;
+
+  m_preSupplyBatched = m_engineCallback && m_engineCallback->batchesPreSupply();
+  if (m_mixThreads.empty() && !m_preSupplyBatched) {
+    size_t activeVoices = 0;
+    size_t silentVoices = 0;
+    if (m_voiceHead) {
+      for (AudioVoice& vox : *m_voiceHead) {
+        ++totalVoices;
+        if (vox.m_running) {
+          ++activeVoices;
+          if (!_pumpVoice<T>(vox, frames, *m_mixScratch[0]) && !vox.m_virtual)
+            ++silentVoices;
+        }
+      }
+    }
+    m_pumpStats.m_activeVoices = activeVoices;
+    m_pumpStats.m_silentVoices = silentVoices;
+    m_pumpStats.m_totalVoices = totalVoices;
+    return;
+  }
+
+  m_activeVoices.clear();
+  if (m_voiceHead) {
+    for (AudioVoice& vox : *m_voiceHead) {
+      ++totalVoices;
+      if (vox.m_running)
+        m_activeVoices.push_back(&vox);
+    }
+  }
+
+  if (m_preSupplyBatched) {
+    m_preSupplyVoices.assign(m_activeVoices.begin(), m_activeVoices.end());
+    m_engineCallback->preSupplyVoices(*this, m_preSupplyVoices.data(), m_preSupplyVoices.size(),
+                                      frames / mixInfo().m_sampleRate);
+  }
+
+  if (m_mixThreads.empty()) {
+    size_t silentVoices = 0;
+    for (AudioVoice* vox : m_activeVoices)
+      if (!_pumpVoice<T>(*vox, frames, *m_mixScratch[0]) && !vox->m_virtual)
+        ++silentVoices;
+    m_pumpStats.m_activeVoices = m_activeVoices.size();
+    m_pumpStats.m_silentVoices = silentVoices;
+    m_pumpStats.m_totalVoices = totalVoices;
+    return;
+  }
+
+  /* Wake workers for this quantum and take the first partition ourselves */
+  m_mixFrames = frames;
+  m_mixJob = &BaseAudioVoiceEngine::_pumpVoiceRange<T>;
+  m_mixPending.store(m_mixThreads.size(), std::memory_order_relaxed);
+  m_mixGeneration.fetch_add(1, std::memory_order_release);
+  m_mixGeneration.notify_all();
+  t_mixThread = false;
+  _pumpVoiceRange<T>(0);
+  t_mixThread = true;
+
+  size_t pending;
+  while ((pending = m_mixPending.load(std::memory_order_acquire)))
+    m_mixPending.wait(pending, std::memory_order_acquire);
+
+  /* Reduce in thread order so the result does not depend on scheduling */
+  for (AudioSubmix* smx : m_mixPlans[m_mixPlanFront].m_order)
+    for (size_t t = 1; t < m_mixScratch.size(); ++t)
+      m_mixScratch[t]->_reduceInto<T>(*smx, frames);
+
+  size_t silentVoices = 0;
+  for (const std::unique_ptr<AudioMixScratch>& scratch : m_mixScratch)
+    silentVoices += scratch->m_silentVoices;
+  m_pumpStats.m_activeVoices = m_activeVoices.size();
+  m_pumpStats.m_silentVoices = silentVoices;
+  m_pumpStats.m_totalVoices = totalVoices;
+}
+
+template <typename T>
+size_t BaseAudioVoiceEngine::_pumpVoice(AudioVoice& vox, size_t frames, AudioMixScratch& scratch) {
+  t_mixVoice = &vox;
+  size_t ret = vox.pumpAndMix<T>(frames, scratch);
+  t_mixVoice = nullptr;
+  return ret;
+}
+
+template <typename T>
+void BaseAudioVoiceEngine::_pumpVoiceRange(size_t threadIdx) {
+  AudioMixScratch& scratch = *m_mixScratch[threadIdx];
+  scratch._beginMerge(m_mixPlans[m_mixPlanFront], m_mixFrames * clientMixInfo().m_channelMap.m_channelCount);
+
+  size_t threadCount = m_mixScratch.size();
+  size_t voiceCount = m_activeVoices.size();
+  size_t end = voiceCount * (threadIdx + 1) / threadCount;
+  scratch.m_silentVoices = 0;
+  for (size_t v = voiceCount * threadIdx / threadCount; v < end; ++v)
+    if (!_pumpVoice<T>(*m_activeVoices[v], m_mixFrames, scratch) && !m_activeVoices[v]->m_virtual)
+      ++scratch.m_silentVoices;
+}
+
+void BaseAudioVoiceEngine::_mixThreadProc(size_t threadIdx) {
+  logvisor::RegisterThreadName(fmt::format(FMT_STRING("Boo Mix {}"), threadIdx).c_str());
+  size_t generation = 0;
+  while (true) {
+    m_mixGeneration.wait(generation, std::memory_order_acquire);
+    generation = m_mixGeneration.load(std::memory_order_acquire);
+    if (m_mixShutdown.load(std::memory_order_relaxed))
+      break;
+    (this->*m_mixJob)(threadIdx);
+    if (m_mixPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      m_mixPending.notify_one();
+  }
+}
+
+void BaseAudioVoiceEngine::_stopMixThreads() {
+  if (m_mixThreads.empty())
+    return;
+  m_mixShutdown.store(true, std::memory_order_relaxed);
+  m_mixGeneration.fetch_add(1, std::memory_order_release);
+  m_mixGeneration.notify_all();
+  for (std::thread& thread : m_mixThreads)
+    thread.join();
+  m_mixThreads.clear();
+  m_mixShutdown.store(false, std::memory_order_relaxed);
 }
 
 template void BaseAudioVoiceEngine::_pumpAndMixVoices<int16_t>(size_t frames, int16_t* dataOut);
 template void BaseAudioVoiceEngine::_pumpAndMixVoices<int32_t>(size_t frames, int32_t* dataOut);
 template void BaseAudioVoiceEngine::_pumpAndMixVoices<float>(size_t frames, float* dataOut);
 
+void BaseAudioVoiceEngine::_submitCommand(AudioCommand& cmd) {
+  /* Callbacks on the owning thread are already synchronized with the pump, as are a voice's callbacks
+   * changing that voice; send changes must still wait for the next quantum's plan rebuild */
+  if (!_isTopologyCommand(cmd) && (t_mixThread || (cmd.m_voice && cmd.m_voice == t_mixVoice))) {
+    _applyCommand(cmd);
+    return;
+  }
+
+  cmd.m_quantum = m_mixQuantum.load(std::memory_order_relaxed) + 1;
+  if (!m_commandOverflowed.load(std::memory_order_acquire) && m_commandQueue.push(cmd))
+    return;
+
+  std::unique_lock lk(m_commandMutex);
+  m_commandOverflow.push_back(cmd);
+  m_commandOverflowed.store(true, std::memory_order_release);
+}
+
+void BaseAudioVoiceEngine::_applyCommand(const AudioCommand& cmd) {
+  if (cmd.m_voice)
+    cmd.m_voice->_applyCommand(cmd);
+  else if (cmd.m_submix)
+    cmd.m_submix->_applyCommand(cmd);
+  else if (cmd.m_type == AudioCommandType::EngineVolume)
+    m_totalVol = cmd.m_level;
+  else if (cmd.m_type == AudioCommandType::EngineVoiceBudget)
+    _setVoiceBudget(cmd.m_count);
+  else if (cmd.m_type == AudioCommandType::EngineMixQuantum)
+    m_quantumFrames = cmd.m_count;
+  else if (cmd.m_type == AudioCommandType::EngineMixThreads)
+    _setMixThreadCount(cmd.m_count);
+}
+
+void BaseAudioVoiceEngine::_drainCommands(size_t quantum) {
+  /* Send commands edit the topology that client-side plan builders read under m_dataMutex. While a client
+   * holds it, they wait in m_topologyCommands (in order) and every other command still applies on time. */
+  std::unique_lock dataLk(m_dataMutex, std::defer_lock);
+  if (m_topologyDeferred.load(std::memory_order_relaxed) && dataLk.try_lock()) {
+    for (const AudioCommand& cmd : m_topologyCommands)
+      _applyCommand(cmd);
+    m_topologyCommands.clear();
+    m_topologyDeferred.store(false, std::memory_order_relaxed);
+  }
+  auto apply = [&](const AudioCommand& cmd) {
+    if (!_isTopologyCommand(cmd) || (m_topologyCommands.empty() && (dataLk || dataLk.try_lock()))) {
+      _applyCommand(cmd);
+      return;
+    }
+    /* Published before the command leaves the ring or spill, for _cancelCommands */
+    m_topologyCommands.push_back(cmd);
+    m_topologyDeferred.store(true, std::memory_order_release);
+  };
+
+  bool drained = true;
+  while (AudioCommand* cmd = m_commandQueue.front()) {
+    if (cmd->m_quantum > quantum) {
+      drained = false;
+      break;
+    }
+    apply(*cmd);
+    m_commandQueue.pop();
+  }
+
+  if (drained && m_commandOverflowed.load(std::memory_order_relaxed)) {
+    for (; m_commandOverflowPos < m_commandOverflow.size(); ++m_commandOverflowPos) {
+      const AudioCommand& cmd = m_commandOverflow[m_commandOverflowPos];
+      if (cmd.m_quantum > quantum)
+        break;
+      apply(cmd);
+    }
+    if (m_commandOverflowPos == m_commandOverflow.size()) {
+      m_commandOverflow.clear();
+      m_commandOverflowPos = 0;
+      m_commandOverflowed.store(false, std::memory_order_release);
+    }
+  }
+
+  /* Only topology commands set it, and those were applied under dataLk */
+  if (m_mixPlanDirty) {
+    m_mixPlanDirty = false;
+    _updateMixPlan();
+  }
+}
+
+void BaseAudioVoiceEngine::_cancelCommands(const IObj* obj) {
+  if (m_commandQueue.empty() && !m_commandOverflowed.load(std::memory_order_acquire) &&
+      !m_topologyDeferred.load(std::memory_order_acquire))
+    return;
+
+  auto cancel = [obj](AudioCommand& cmd) {
+    if (cmd.m_voice == obj || cmd.m_submix == obj || cmd.m_send == obj)
+      cmd = AudioCommand();
+  };
+  std::unique_lock lk(m_commandMutex);
+  m_commandQueue.forEachPending(cancel);
+  for (size_t i = m_commandOverflowPos; i < m_commandOverflow.size(); ++i)
+    cancel(m_commandOverflow[i]);
+  for (AudioCommand& cmd : m_topologyCommands)
+    cancel(cmd);
+}
+
+void BaseAudioVoiceEngine::_buildMixPlan(AudioSubmix& smx, AudioMixPlan& plan) {
+  int& mixIdx = smx.m_mixIdx[plan.m_slot];
+  if (mixIdx != -1)
+    return;
+
+  /* Mark as visiting so a send cycle terminates instead of recursing forever */
+  mixIdx = -2;
+  for (AudioSubmix& dep : *m_submixHead)
+    if (&dep != &smx && dep._isDirectDependencyOf(&smx))
+      _buildMixPlan(dep, plan);
+
+  mixIdx = int(plan.m_order.size());
+  plan.m_order.push_back(&smx);
+}
+
+void BaseAudioVoiceEngine::_updateMixPlan() {
+  std::unique_lock<std::recursive_mutex> lk(m_dataMutex);
+
+  /* The back plan belongs to builders alone, including its slot of each submix's m_mixIdx */
+  AudioMixPlan& plan = m_mixPlans[m_mixPlanBack];
+  plan.m_order.clear();
+  if (m_submixHead)
+    for (AudioSubmix& smx : *m_submixHead)
+      smx.m_mixIdx[plan.m_slot] = -1;
+  if (m_mainSubmix)
+    _buildMixPlan(*m_mainSubmix, plan);
+
+  /* Resolve each send against the order once, so the pump never walks sends to unrouted submixes */
+  plan.m_sends.clear();
+  plan.m_sendBegin.clear();
+  for (AudioSubmix* smx : plan.m_order) {
+    plan.m_sendBegin.push_back(plan.m_sends.size());
+    for (size_t g = 0; g < smx->m_sendGains.size(); ++g) {
+      auto target = std::find(plan.m_order.begin(), plan.m_order.end(), smx->m_sendGains.begin()[g].m_submix);
+      if (target != plan.m_order.end())
+        plan.m_sends.push_back({size_t(target - plan.m_order.begin()), g});
+    }
+  }
+  plan.m_sendBegin.push_back(plan.m_sends.size());
+
+  m_mixPlanBack = m_mixPlanShared.exchange(m_mixPlanBack | FreshMixPlan, std::memory_order_acq_rel) & ~FreshMixPlan;
+}
+
+const AudioMixPlan& BaseAudioVoiceEngine::_acquireMixPlan() {
+  if (m_mixPlanShared.load(std::memory_order_relaxed) & FreshMixPlan)
+    m_mixPlanFront = m_mixPlanShared.exchange(m_mixPlanFront, std::memory_order_acq_rel) & ~FreshMixPlan;
+  return m_mixPlans[m_mixPlanFront];
+}
+
 void BaseAudioVoiceEngine::_resetSampleRate() {
+  std::unique_lock<std::recursive_mutex> lk(m_dataMutex);
+  m_floatMixInfo = m_mixInfo;
+  m_floatMixInfo.m_sampleFormat = SOXR_FLOAT32_I;
+  m_floatMixInfo.m_bitsPerSample = 32;
+
+  /* Idle resamplers were designed for the previous mix format; those still held are destroyed on release */
+  m_resamplerPool.purge();
+
   if (m_voiceHead)
     for (boo::AudioVoice& vox : *m_voiceHead)
-      vox._resetSampleRate(vox.m_sampleRateIn);
+      vox._resetSampleRate(vox.m_sampleRateIn, true);
   if (m_submixHead)
     for (boo::AudioSubmix& smx : *m_submixHead)
       smx._resetOutputSampleRate();
 }
 
 ObjToken<IAudioVoice> BaseAudioVoiceEngine::allocateNewMonoVoice(double sampleRate, IAudioVoiceCallback* cb,
-                                                                 bool dynamicPitch) {
-  return {new AudioVoiceMono(*this, cb, sampleRate, dynamicPitch)};
+                                                                 bool dynamicPitch, AudioVoiceQuality quality,
+                                                                 AudioSourceFormat format) {
+  return {new AudioVoiceMono(*this, cb, sampleRate, dynamicPitch, quality, format)};
 }
 
 ObjToken<IAudioVoice> BaseAudioVoiceEngine::allocateNewStereoVoice(double sampleRate, IAudioVoiceCallback* cb,
-                                                                   bool dynamicPitch) {
-  return {new AudioVoiceStereo(*this, cb, sampleRate, dynamicPitch)};
+                                                                   bool dynamicPitch, AudioVoiceQuality quality,
+                                                                   AudioSourceFormat format) {
+  return {new AudioVoiceStereo(*this, cb, sampleRate, dynamicPitch, quality, format)};
+}
+
+ObjToken<IAudioVoice> BaseAudioVoiceEngine::allocateNewStreamingVoice(double sampleRate, unsigned channels,
+                                                                      IAudioVoiceCallback* cb,
+                                                                      IAudioStreamSource* source,
+                                                                      double prefetchSeconds, bool dynamicPitch,
+                                                                      AudioVoiceQuality quality,
+                                                                      AudioSourceFormat format) {
+  if (channels != 1 && channels != 2) {
+    Log.report(logvisor::Error, FMT_STRING("streaming voices must be mono or stereo, not {} channels"), channels);
+    return {};
+  }
+
+  size_t capacity = size_t(std::ceil(std::max(prefetchSeconds, MinStreamPrefetchSeconds) * sampleRate));
+  auto stream = std::make_shared<AudioStream>(m_streamPool, cb, source, format, channels, capacity);
+
+  AudioVoice* voice;
+  if (channels == 2)
+    voice = new AudioVoiceStereo(*this, stream.get(), sampleRate, dynamicPitch, quality, format);
+  else
+    voice = new AudioVoiceMono(*this, stream.get(), sampleRate, dynamicPitch, quality, format);
+  voice->m_stream = stream;
+  m_streamPool.add(std::move(stream));
+  return {voice};
+}
+
+void BaseAudioVoiceEngine::warmResamplers(double sampleRate, unsigned channels, size_t count, bool dynamicPitch,
+                                          AudioVoiceQuality quality, AudioSourceFormat format) {
+  /* Voices of this rate pass audio straight through until pitched */
+  if (sampleRate == m_mixInfo.m_sampleRate && !dynamicPitch)
+    return;
+  m_resamplerPool.warm(
+      {sampleRate, m_mixInfo.m_sampleRate, channels, format, mixInfo().m_sampleFormat, quality, dynamicPitch}, count);
 }
 
 ObjToken<IAudioSubmix> BaseAudioVoiceEngine::allocateNewSubmix(bool mainOut, IAudioSubmixCallback* cb, int busId) {
   return {new AudioSubmix(*this, cb, busId, mainOut)};
 }
 
-void BaseAudioVoiceEngine::setCallbackInterface(IAudioVoiceEngineCallback* cb) { m_engineCallback = cb; }
+void BaseAudioVoiceEngine::setCallbackInterface(IAudioVoiceEngineCallback* cb) {
+  std::unique_lock<std::recursive_mutex> lk(m_dataMutex);
+  m_engineCallback = cb;
+}
+
+void BaseAudioVoiceEngine::_setMixThreadCount(size_t count) {
+  if (std::max(count, size_t(1)) == m_mixScratch.size())
+    return;
+  _stopMixThreads();
+  m_mixScratch.resize(std::max(count, size_t(1)));
+  for (size_t t = 0; t < m_mixScratch.size(); ++t) {
+    if (!m_mixScratch[t])
+      m_mixScratch[t] = std::make_unique<AudioMixScratch>();
+    m_mixScratch[t]->m_threadIdx = t;
+  }
+  m_mixGeneration.store(0, std::memory_order_relaxed);
+  for (size_t t = 1; t < m_mixScratch.size(); ++t)
+    m_mixThreads.emplace_back(&BaseAudioVoiceEngine::_mixThreadProc, this, t);
+}
+
+void BaseAudioVoiceEngine::setMixThreadCount(size_t count) {
+  /* Workers and their scratch are resized between quanta on the pumping thread */
+  AudioCommand cmd;
+  cmd.m_type = AudioCommandType::EngineMixThreads;
+  cmd.m_count = count;
+  _submitCommand(cmd);
+}
+
+void BaseAudioVoiceEngine::setStreamThreadCount(size_t count) { m_streamPool.setThreadCount(count); }
+
+void BaseAudioVoiceEngine::setVolume(float vol) {
+  AudioCommand cmd;
+  cmd.m_type = AudioCommandType::EngineVolume;
+  cmd.m_level = vol;
+  _submitCommand(cmd);
+}
+
+void BaseAudioVoiceEngine::_setVoiceBudget(size_t realVoices) {
+  m_voiceBudget = realVoices;
+  if (m_voiceBudget || !m_voiceHead)
+    return;
+  /* Culling no longer runs to release virtual voices */
+  for (AudioVoice& vox : *m_voiceHead)
+    vox.m_virtual = false;
+}
+
+void BaseAudioVoiceEngine::setVoiceBudget(size_t realVoices) {
+  AudioCommand cmd;
+  cmd.m_type = AudioCommandType::EngineVoiceBudget;
+  cmd.m_count = realVoices;
+  _submitCommand(cmd);
+}
+
+void BaseAudioVoiceEngine::setVoicePans(const AudioVoicePan* pans, size_t count, bool slew) {
+  const ChannelMap& chMap = clientMixInfo().m_channelMap;
+  AudioPanBatch batch;
+  size_t begin = 0;
+  while (begin < count) {
+    /* Gather whole voices into the batch */
+    batch.m_count = 0;
+    size_t end = begin;
+    for (; end < count; ++end) {
+      const AudioVoicePan& pan = pans[end];
+      if (!pan.m_voice)
+        continue;
+      const AudioVoice& voice = static_cast<const AudioVoice&>(*pan.m_voice);
+      if (batch.m_count + voice.m_channelCount > AudioPanBatch::Capacity)
+        break;
+      if (voice.m_channelCount == 2)
+        batch.addStereo(pan.m_position, pan.m_width, pan.m_spread, pan.m_gain);
+      else
+        batch.add(pan.m_position[0], pan.m_position[1], pan.m_position[2], pan.m_spread, pan.m_gain);
+    }
+
+    ComputePanGains(chMap, batch);
+
+    size_t src = 0;
+    for (size_t p = begin; p < end; ++p) {
+      if (!pans[p].m_voice)
+        continue;
+      AudioVoice& voice = static_cast<AudioVoice&>(*pans[p].m_voice);
+      AudioCommand cmd(voice.m_channelCount == 2 ? AudioCommandType::VoiceStereoChannelLevels
+                                                 : AudioCommandType::VoiceMonoChannelLevels,
+                       &voice);
+      cmd.m_send = pans[p].m_submix;
+      cmd.m_slew = slew;
+      for (int c = 0; c < 8; ++c) {
+        if (voice.m_channelCount == 2) {
+          cmd.m_stereoCoefs[c][0] = batch.m_gains[c][src];
+          cmd.m_stereoCoefs[c][1] = batch.m_gains[c][src + 1];
+        } else {
+          cmd.m_monoCoefs[c] = batch.m_gains[c][src];
+        }
+      }
+      src += voice.m_channelCount;
+      _submitCommand(cmd);
+    }
+    begin = end;
+  }
+}
+
+bool BaseAudioVoiceEngine::setMixQuantum(size_t frames) {
+  if (frames && (frames < MinMixQuantumFrames || frames > MaxMixQuantumFrames || (frames & (frames - 1)))) {
+    Log.report(logvisor::Error, FMT_STRING("mix quantum of {} frames is not a power of two in [{}, {}]"), frames,
+               MinMixQuantumFrames, MaxMixQuantumFrames);
+    return false;
+  }
+
+  m_quantumFramesShared.store(frames, std::memory_order_relaxed);
+  AudioCommand cmd;
+  cmd.m_type = AudioCommandType::EngineMixQuantum;
+  cmd.m_count = frames;
+  _submitCommand(cmd);
+  return true;
+}
 
-void BaseAudioVoiceEngine::setVolume(float vol) { m_totalVol = vol; }
+size_t BaseAudioVoiceEngine::getMixQuantum() const {
+  size_t frames = m_quantumFramesShared.load(std::memory_order_relaxed);
+  return frames ? frames : m_5msFrames;
+}
+
+void BaseAudioVoiceEngine::setFloatMix(bool enable, bool dither) {
+  std::unique_lock<std::recursive_mutex> lk(m_dataMutex);
+  m_floatMixDither = dither;
+  if (enable == m_floatMix)
+    return;
+  m_floatMix = enable;
+  _resetSampleRate();
+
+  /* The encoder's window ring holds samples of the mix format */
+  if (m_ltRtProcessing)
+    m_ltRtProcessing = std::make_unique<LtRtProcessing>(m_5msFrames, mixInfo());
+}
 
 bool BaseAudioVoiceEngine::enableLtRt(bool enable) {
+  std::unique_lock<std::recursive_mutex> lk(m_dataMutex);
   if (enable && m_mixInfo.m_channelMap.m_channelCount == 2 && m_mixInfo.m_channels == AudioChannelSet::Stereo)
-    m_ltRtProcessing = std::make_unique<LtRtProcessing>(m_5msFrames, m_mixInfo);
+    m_ltRtProcessing = std::make_unique<LtRtProcessing>(m_5msFrames, mixInfo());
   else
     m_ltRtProcessing.reset();
   return m_ltRtProcessing.operator bool();
 }
 
-const AudioVoiceEngineMixInfo& BaseAudioVoiceEngine::mixInfo() const { return m_mixInfo; }
+AudioRenderStats BaseAudioVoiceEngine::renderSeconds(double seconds) {
+  return renderFrames(size_t(seconds * m_mixInfo.m_sampleRate));
+}
+
+void BaseAudioVoiceEngine::_publishStats() {
+  /* Readers hold the mutex only to copy; skip a contended publish rather than stall the audio thread */
+  std::unique_lock lk(m_statsMutex, std::try_to_lock);
+  if (lk)
+    m_pumpStatsShared = m_pumpStats;
+}
+
+AudioEngineStats BaseAudioVoiceEngine::getStats() const {
+  AudioPumpStats pump;
+  {
+    std::unique_lock lk(m_statsMutex);
+    pump = m_pumpStatsShared;
+  }
+
+  AudioEngineStats ret;
+  ret.m_pumps = pump.m_pumps;
+  if (pump.m_pumps) {
+    ret.m_pumpMinSeconds = pump.m_pumpMin;
+    ret.m_pumpMeanSeconds = pump.m_pumpTotal / pump.m_pumps;
+    ret.m_pumpP99Seconds = pump._percentile(0.99);
+    ret.m_pumpMaxSeconds = pump.m_pumpMax;
+  }
+  ret.m_voiceSeconds = pump.m_voiceTotal;
+  ret.m_submixSeconds = pump.m_submixTotal;
+  ret.m_ltRtSeconds = pump.m_ltRtTotal;
+  ret.m_activeVoices = pump.m_activeVoices;
+  ret.m_silentVoices = pump.m_silentVoices;
+  ret.m_virtualVoices = pump.m_virtualVoices;
+  ret.m_totalVoices = pump.m_totalVoices;
+  ret.m_underruns = m_underruns.load(std::memory_order_relaxed);
+  ret.m_deviceLatencySeconds = pump.m_deviceLatency;
+  return ret;
+}
+
+void BaseAudioVoiceEngine::resetStats() {
+  m_statsReset.store(true, std::memory_order_release);
+  m_underruns.store(0, std::memory_order_relaxed);
+  std::unique_lock lk(m_statsMutex);
+  double deviceLatency = m_pumpStatsShared.m_deviceLatency;
+  m_pumpStatsShared = AudioPumpStats();
+  m_pumpStatsShared.m_deviceLatency = deviceLatency;
+}
+
+const AudioVoiceEngineMixInfo& BaseAudioVoiceEngine::mixInfo() const {
+  return m_floatMix ? m_floatMixInfo : m_mixInfo;
+}
 
 const AudioVoiceEngineMixInfo& BaseAudioVoiceEngine::clientMixInfo() const {
-  return m_ltRtProcessing ? m_ltRtProcessing->inMixInfo() : m_mixInfo;
+  return m_ltRtProcessing ? m_ltRtProcessing->inMixInfo() : mixInfo();
 }
 
 } // namespace boo
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
-#include <list>
 #include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 #include "boo/BooObject.hpp"
 #include "boo/audiodev/IAudioVoiceEngine.hpp"
+#include "lib/audiodev/AudioCommandQueue.hpp"
+#include "lib/audiodev/AudioQuantize.hpp"
+#include "lib/audiodev/AudioResamplerPool.hpp"
+#include "lib/audiodev/AudioStream.hpp"
 #include "lib/audiodev/AudioSubmix.hpp"
 #include "lib/audiodev/AudioVoice.hpp"
 #include "lib/audiodev/Common.hpp"
@@ -16,6 +21,100 @@
 
 namespace boo {
 
+/** Compiled submix execution order.
+ *  Topology changes rebuild a spare plan on the mutating thread and publish it; the pumping
+ *  thread adopts the newest plan at the start of each mix quantum without locking or allocating. */
+struct AudioMixPlan {
+  /* Index of this plan within the engine and within each submix's m_mixIdx */
+  size_t m_slot = 0;
+
+  /* Submixes routed to the main output; each one precedes every submix it sends to */
+  std::vector<AudioSubmix*> m_order;
+
+  /* Send of a submix to another submix in m_order */
+  struct Send {
+    size_t m_target; /* Position of the destination within m_order */
+    size_t m_gains;  /* Index of the gains within the source's m_sendGains */
+  };
+
+  /* Sends of m_order[i] occupy m_sends[m_sendBegin[i]] up to m_sends[m_sendBegin[i + 1]] */
+  std::vector<Send> m_sends;
+  std::vector<size_t> m_sendBegin;
+};
+
+/** Pump measurements accumulated by the pumping thread since the last stats reset */
+struct AudioPumpStats {
+  /* Pump times are binned by BucketsPerOctave * log2(1 + microseconds); the last bucket absorbs the tail */
+  static constexpr size_t BucketsPerOctave = 8;
+  static constexpr size_t HistogramBuckets = 128;
+  uint32_t m_histogram[HistogramBuckets] = {};
+
+  size_t m_pumps = 0;
+  double m_pumpMin = 0.0;
+  double m_pumpMax = 0.0;
+  double m_pumpTotal = 0.0;
+  double m_voiceTotal = 0.0;
+  double m_submixTotal = 0.0;
+  double m_ltRtTotal = 0.0;
+  size_t m_activeVoices = 0;
+  size_t m_silentVoices = 0;
+  size_t m_virtualVoices = 0;
+  size_t m_totalVoices = 0;
+  double m_deviceLatency = -1.0;
+
+  void _addPump(double seconds);
+
+  /* Upper edge of the bucket holding the specified fraction of pumps */
+  double _percentile(double fraction) const;
+};
+
+/** Scratch state owned by one mixing thread while it pumps its share of the active voices */
+struct AudioMixScratch {
+  /* Thread 0 is the pumping thread and mixes straight into submix buffers */
+  size_t m_threadIdx = 0;
+
+  /* Real voices of this thread's partition that mixed nothing in the current quantum */
+  size_t m_silentVoices = 0;
+
+  /* Scratch buffers for accumulating audio data for resampling */
+  std::vector<int16_t> m_scratchIn16;
+  std::vector<int32_t> m_scratchIn32;
+  std::vector<float> m_scratchInFlt;
+  template <typename T>
+  std::vector<T>& _getScratchIn();
+  std::vector<int16_t> m_scratch16Pre;
+  std::vector<int32_t> m_scratch32Pre;
+  std::vector<float> m_scratchFltPre;
+  template <typename T>
+  std::vector<T>& _getScratchPre();
+  std::vector<int16_t> m_scratch16Post;
+  std::vector<int32_t> m_scratch32Post;
+  std::vector<float> m_scratchFltPost;
+  template <typename T>
+  std::vector<T>& _getScratchPost();
+
+  /* Private per-submix merge buffers of other threads, reduced into the submixes in thread order;
+   * the trailing slot absorbs sends to submixes that are not routed to the main output */
+  std::vector<int16_t> m_merge16;
+  std::vector<int32_t> m_merge32;
+  std::vector<float> m_mergeFlt;
+  template <typename T>
+  std::vector<T>& _getMerge();
+  std::vector<uint8_t> m_mergeUsed;
+  size_t m_mergeStride = 0;
+  size_t m_planSlot = 0;
+
+  void _beginMerge(const AudioMixPlan& plan, size_t stride);
+
+  /* Destination for a voice mixing into the specified submix */
+  template <typename T>
+  T* _getMergeBuf(AudioSubmix& smx, size_t frames);
+
+  /* Sum this thread's contribution to the specified submix into the submix itself */
+  template <typename T>
+  void _reduceInto(AudioSubmix& smx, size_t frames);
+};
+
 /** Base class for managing mixing and sample-rate-conversion amongst active voices */
 class BaseAudioVoiceEngine : public IAudioVoiceEngine {
 protected:
@@ -31,95 +130,223 @@ protected:
   size_t m_5msFrames = 0;
   IAudioVoiceEngineCallback* m_engineCallback = nullptr;
 
-  /* Shared scratch buffers for accumulating audio data for resampling */
-  std::vector<int16_t> m_scratchIn;
-  std::vector<int16_t> m_scratch16Pre;
-  std::vector<int32_t> m_scratch32Pre;
-  std::vector<float> m_scratchFltPre;
+  /* Frames per mix quantum, or 0 to follow m_5msFrames (which backends set once the device rate is known);
+   * m_quantumFramesShared mirrors it for getMixQuantum() on client threads */
+  size_t m_quantumFrames = 0;
+  std::atomic_size_t m_quantumFramesShared = 0;
+  size_t _quantumFrames() const { return m_quantumFrames ? m_quantumFrames : m_5msFrames; }
+
+  /* Idle resamplers recycled between voices */
+  AudioResamplerPool m_resamplerPool;
+
+  /* Background readers of streaming voices' sources */
+  AudioStreamPool m_streamPool;
+
+  /* Parameter changes posted by client threads; the pumping thread applies them at the top of the
+   * quantum following the one they were posted in. Bursts that outrun the ring spill into
+   * m_commandOverflow, which is drained after the ring to keep each thread's commands in order.
+   * m_commandMutex guards the spill and serializes consumers; the pump only try-locks it, so a contended
+   * drain is deferred to the next quantum rather than blocking the audio thread. Send commands edit the
+   * topology and also need m_dataMutex; while a client holds it they wait in m_topologyCommands
+   * (guarded by m_commandMutex) without holding up the other commands. */
+  AudioCommandQueue m_commandQueue;
+  std::mutex m_commandMutex;
+  std::vector<AudioCommand> m_commandOverflow;
+  size_t m_commandOverflowPos = 0;
+  std::atomic_bool m_commandOverflowed = false;
+  std::vector<AudioCommand> m_topologyCommands;
+  std::atomic_bool m_topologyDeferred = false;
+  std::atomic_size_t m_mixQuantum = 0;
+  static bool _isTopologyCommand(const AudioCommand& cmd) {
+    return cmd.m_type == AudioCommandType::SubmixSendLevel || cmd.m_type == AudioCommandType::SubmixResetSendLevels;
+  }
+  void _submitCommand(AudioCommand& cmd);
+  void _applyCommand(const AudioCommand& cmd);
+  void _drainCommands(size_t quantum);
+  void _cancelCommands(const IObj* obj);
+
+  /* Telemetry: the pumping thread accumulates into m_pumpStats and copies it to m_pumpStatsShared after
+   * each pump when m_statsMutex is uncontended; getStats() reads the shared copy. Backends report
+   * underruns from whichever thread observes them and device latency from the pumping thread. */
+  AudioPumpStats m_pumpStats;
+  AudioPumpStats m_pumpStatsShared;
+  mutable std::mutex m_statsMutex;
+  std::atomic_bool m_statsReset = false;
+  std::atomic_size_t m_underruns = 0;
+  void _publishStats();
+  void _reportUnderrun() { m_underruns.fetch_add(1, std::memory_order_relaxed); }
+  void _setDeviceLatency(double seconds) { m_pumpStats.m_deviceLatency = seconds; }
+
+  /* Per-thread scratch for pumping voices; [0] belongs to the pumping thread */
+  std::vector<std::unique_ptr<AudioMixScratch>> m_mixScratch;
+
+  /* Worker threads pumping static partitions of m_activeVoices */
+  std::vector<std::thread> m_mixThreads;
+  std::vector<AudioVoice*> m_activeVoices;
+
+  /* Set for quanta in which the engine callback pre-supplies m_preSupplyVoices (the running voices) in one batch */
+  bool m_preSupplyBatched = false;
+  std::vector<IAudioVoice*> m_preSupplyVoices;
+  std::atomic_size_t m_mixGeneration = 0;
+  std::atomic_size_t m_mixPending = 0;
+  std::atomic_bool m_mixShutdown = false;
+  size_t m_mixFrames = 0;
+  void (BaseAudioVoiceEngine::*m_mixJob)(size_t threadIdx) = nullptr;
+  void _mixThreadProc(size_t threadIdx);
+  void _stopMixThreads();
+  void _setMixThreadCount(size_t count);
   template <typename T>
-  std::vector<T>& _getScratchPre();
-  std::vector<int16_t> m_scratch16Post;
-  std::vector<int32_t> m_scratch32Post;
-  std::vector<float> m_scratchFltPost;
+  size_t _pumpVoice(AudioVoice& vox, size_t frames, AudioMixScratch& scratch);
   template <typename T>
-  std::vector<T>& _getScratchPost();
+  void _pumpVoiceRange(size_t threadIdx);
+  template <typename T>
+  void _pumpVoices(size_t frames);
+
+  /* Real-voice budget (0 for unlimited); each quantum the pumping thread ranks the audible running voices
+   * in m_voiceRanks and virtualizes those beyond the budget, returning how many it virtualized */
+  struct AudioVoiceRank {
+    int m_priority;
+    float m_audibility;
+    AudioVoice* m_voice;
+  };
+  size_t m_voiceBudget = 0;
+  std::vector<AudioVoiceRank> m_voiceRanks;
+  size_t _cullVoices(const AudioMixPlan& plan);
+  void _setVoiceBudget(size_t realVoices);
 
   /* LtRt processing if enabled */
   std::unique_ptr<LtRtProcessing> m_ltRtProcessing;
-  std::vector<int16_t> m_ltRtIn16;
-  std::vector<int32_t> m_ltRtIn32;
-  std::vector<float> m_ltRtInFlt;
-  template <typename T>
-  std::vector<T>& _getLtRtIn();
+
+  /* Float accumulation for integer devices: mixInfo() reports m_floatMixInfo to voices and submixes,
+   * and each quantum is mixed into m_floatBus, then scaled, clipped and converted into the device buffer */
+  bool m_floatMix = false;
+  bool m_floatMixDither = false;
+  AudioVoiceEngineMixInfo m_floatMixInfo;
+  std::vector<float> m_floatBus;
+  DitherState m_ditherState;
 
   std::unique_ptr<AudioSubmix> m_mainSubmix;
-  std::list<AudioSubmix*> m_linearizedSubmixes;
-  bool m_submixesDirty = true;
+
+  /* Triple-buffered mix plans: the pumping thread owns the front plan, builders own the back plan,
+   * and m_mixPlanShared holds the remaining slot, flagged when it is newer than the front */
+  static constexpr uint8_t FreshMixPlan = 0x4;
+  AudioMixPlan m_mixPlans[3];
+  uint8_t m_mixPlanFront = 0;
+  uint8_t m_mixPlanBack = 2;
+  std::atomic_uint8_t m_mixPlanShared = 1;
+  bool m_mixPlanDirty = false; /* Set by send commands; the pump rebuilds after draining them */
+  void _buildMixPlan(AudioSubmix& smx, AudioMixPlan& plan);
+  void _updateMixPlan();
+  const AudioMixPlan& _acquireMixPlan();
 
   template <typename T>
   void _pumpAndMixVoices(size_t frames, T* dataOut);
+  template <typename B, typename T>
+  void _pumpAndMixBus(size_t frames, T* dataOut);
 
   void _resetSampleRate();
 
 public:
-  BaseAudioVoiceEngine() : m_mainSubmix(std::make_unique<AudioSubmix>(*this, nullptr, -1, false)) {}
+  BaseAudioVoiceEngine() : m_mainSubmix(std::make_unique<AudioSubmix>(*this, nullptr, -1, false)) {
+    m_mixScratch.push_back(std::make_unique<AudioMixScratch>());
+    for (size_t i = 0; i < 3; ++i)
+      m_mixPlans[i].m_slot = i;
+    _updateMixPlan();
+  }
   ~BaseAudioVoiceEngine() override;
-  ObjToken<IAudioVoice> allocateNewMonoVoice(double sampleRate, IAudioVoiceCallback* cb,
-                                             bool dynamicPitch = false) override;
+  ObjToken<IAudioVoice> allocateNewMonoVoice(double sampleRate, IAudioVoiceCallback* cb, bool dynamicPitch = false,
+                                             AudioVoiceQuality quality = AudioVoiceQuality::High,
+                                             AudioSourceFormat format = AudioSourceFormat::Int16) override;
+
+  ObjToken<IAudioVoice> allocateNewStereoVoice(double sampleRate, IAudioVoiceCallback* cb, bool dynamicPitch = false,
+                                               AudioVoiceQuality quality = AudioVoiceQuality::High,
+                                               AudioSourceFormat format = AudioSourceFormat::Int16) override;
+
+  ObjToken<IAudioVoice> allocateNewStreamingVoice(double sampleRate, unsigned channels, IAudioVoiceCallback* cb,
+                                                  IAudioStreamSource* source, double prefetchSeconds = 0.5,
+                                                  bool dynamicPitch = false,
+                                                  AudioVoiceQuality quality = AudioVoiceQuality::High,
+                                                  AudioSourceFormat format = AudioSourceFormat::Int16) override;
 
-  ObjToken<IAudioVoice> allocateNewStereoVoice(double sampleRate, IAudioVoiceCallback* cb,
-                                               bool dynamicPitch = false) override;
+  void warmResamplers(double sampleRate, unsigned channels, size_t count, bool dynamicPitch = false,
+                      AudioVoiceQuality quality = AudioVoiceQuality::High,
+                      AudioSourceFormat format = AudioSourceFormat::Int16) override;
 
   ObjToken<IAudioSubmix> allocateNewSubmix(bool mainOut, IAudioSubmixCallback* cb, int busId) override;
 
   void setCallbackInterface(IAudioVoiceEngineCallback* cb) override;
 
+  bool setRealtimeThread(bool enable) override { return !enable; }
+  void setMixThreadCount(size_t count) override;
+  void setStreamThreadCount(size_t count) override;
   void setVolume(float vol) override;
+  void setVoiceBudget(size_t realVoices) override;
+  void setVoicePans(const AudioVoicePan* pans, size_t count, bool slew) override;
+  bool setMixQuantum(size_t frames) override;
+  size_t getMixQuantum() const override;
+  void setFloatMix(bool enable, bool dither = false) override;
   bool enableLtRt(bool enable) override;
   const AudioVoiceEngineMixInfo& mixInfo() const;
   const AudioVoiceEngineMixInfo& clientMixInfo() const;
   AudioChannelSet getAvailableSet() override { return clientMixInfo().m_channels; }
   void pumpAndMixVoices() override {}
+  AudioRenderStats renderFrames(size_t frames) override { return {}; }
+  AudioRenderStats renderSeconds(double seconds) override;
   size_t get5MsFrames() const override { return m_5msFrames; }
+  AudioEngineStats getStats() const override;
+  void resetStats() override;
 };
 
 template <>
-inline std::vector<int16_t>& BaseAudioVoiceEngine::_getScratchPre<int16_t>() {
+inline std::vector<int16_t>& AudioMixScratch::_getScratchIn<int16_t>() {
+  return m_scratchIn16;
+}
+template <>
+inline std::vector<int32_t>& AudioMixScratch::_getScratchIn<int32_t>() {
+  return m_scratchIn32;
+}
+template <>
+inline std::vector<float>& AudioMixScratch::_getScratchIn<float>() {
+  return m_scratchInFlt;
+}
+
+template <>
+inline std::vector<int16_t>& AudioMixScratch::_getScratchPre<int16_t>() {
   return m_scratch16Pre;
 }
 template <>
-inline std::vector<int32_t>& BaseAudioVoiceEngine::_getScratchPre<int32_t>() {
+inline std::vector<int32_t>& AudioMixScratch::_getScratchPre<int32_t>() {
   return m_scratch32Pre;
 }
 template <>
-inline std::vector<float>& BaseAudioVoiceEngine::_getScratchPre<float>() {
+inline std::vector<float>& AudioMixScratch::_getScratchPre<float>() {
   return m_scratchFltPre;
 }
 
 template <>
-inline std::vector<int16_t>& BaseAudioVoiceEngine::_getScratchPost<int16_t>() {
+inline std::vector<int16_t>& AudioMixScratch::_getScratchPost<int16_t>() {
   return m_scratch16Post;
 }
 template <>
-inline std::vector<int32_t>& BaseAudioVoiceEngine::_getScratchPost<int32_t>() {
+inline std::vector<int32_t>& AudioMixScratch::_getScratchPost<int32_t>() {
   return m_scratch32Post;
 }
 template <>
-inline std::vector<float>& BaseAudioVoiceEngine::_getScratchPost<float>() {
+inline std::vector<float>& AudioMixScratch::_getScratchPost<float>() {
   return m_scratchFltPost;
 }
 
 template <>
-inline std::vector<int16_t>& BaseAudioVoiceEngine::_getLtRtIn<int16_t>() {
-  return m_ltRtIn16;
+inline std::vector<int16_t>& AudioMixScratch::_getMerge<int16_t>() {
+  return m_merge16;
 }
 template <>
-inline std::vector<int32_t>& BaseAudioVoiceEngine::_getLtRtIn<int32_t>() {
-  return m_ltRtIn32;
+inline std::vector<int32_t>& AudioMixScratch::_getMerge<int32_t>() {
+  return m_merge32;
 }
 template <>
-inline std::vector<float>& BaseAudioVoiceEngine::_getLtRtIn<float>() {
-  return m_ltRtInFlt;
+inline std::vector<float>& AudioMixScratch::_getMerge<float>() {
+  return m_mergeFlt;
 }
 
 } // namespace boo
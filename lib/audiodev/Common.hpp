@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+
 #include <soxr.h>
 #include "boo/audiodev/IAudioVoice.hpp"
 #include "lib/Common.hpp"
@@ -16,4 +20,59 @@ struct AudioVoiceEngineMixInfo {
   size_t m_periodFrames = 160;
 };
 
+/** Contiguous per-send state keyed by destination submix, in insertion order.
+ *  The first InlineCount sends live inside the table itself; most voices and submixes
+ *  have only one to three, so the mix loop walks them without hashing or heap traffic. */
+template <typename T, size_t InlineCount = 4>
+class SendTable {
+public:
+  struct Entry {
+    IAudioSubmix* m_submix = nullptr;
+    T m_value = {};
+  };
+
+private:
+  Entry m_inline[InlineCount];
+  std::unique_ptr<Entry[]> m_heap;
+  Entry* m_data = m_inline;
+  size_t m_size = 0;
+  size_t m_capacity = InlineCount;
+
+public:
+  SendTable() = default;
+  SendTable(const SendTable&) = delete;
+  SendTable& operator=(const SendTable&) = delete;
+
+  Entry* begin() { return m_data; }
+  Entry* end() { return m_data + m_size; }
+  const Entry* begin() const { return m_data; }
+  const Entry* end() const { return m_data + m_size; }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  void clear() { m_size = 0; }
+
+  Entry* find(const IAudioSubmix* submix) {
+    for (Entry& e : *this)
+      if (e.m_submix == submix)
+        return &e;
+    return nullptr;
+  }
+  const Entry* find(const IAudioSubmix* submix) const { return const_cast<SendTable*>(this)->find(submix); }
+
+  /* Appends a default-valued entry; callers look up existing sends with find() first */
+  Entry& emplace(IAudioSubmix* submix) {
+    if (m_size == m_capacity) {
+      std::unique_ptr<Entry[]> heap(new Entry[m_capacity * 2]);
+      std::copy(begin(), end(), heap.get());
+      m_heap = std::move(heap);
+      m_data = m_heap.get();
+      m_capacity *= 2;
+    }
+    Entry& e = m_data[m_size++];
+    e.m_submix = submix;
+    e.m_value = T{};
+    return e;
+  }
+};
+
 } // namespace boo
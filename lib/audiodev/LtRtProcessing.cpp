@@ -3,9 +3,25 @@
 #include <algorithm>
 #include <cmath>
 
+#if !INTEL_IPP
+#if defined(__x86_64__) || defined(_M_AMD64)
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define __SSE__ 1
+#include "sse2neon.h"
+#endif
+
+/* Ooura real DFT exported by the vendored soxr (fft4g.c) */
+extern "C" void _soxr_rdft_f(int n, int isgn, float* a, int* ip, float* w);
+#endif
+
 #undef min
 #undef max
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846 /* pi */
+#endif
+
 namespace boo {
 namespace {
 template <typename T>
@@ -28,10 +44,6 @@ constexpr T ClampFull(float in) {
 
 #if INTEL_IPP
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846 /* pi */
-#endif
-
 #if USE_LPF
 constexpr int FirTaps = 27;
 
@@ -82,9 +94,11 @@ WindowedHilbert::WindowedHilbert(int windowFrames, double sampleRate)
 , m_halfFrames(windowFrames / 2)
 , m_inputBuf(ippsMalloc_32f(m_windowFrames * 2 + m_halfFrames))
 , m_outputBuf(ippsMalloc_32fc(m_windowFrames * 4))
-, m_hammingTable(ippsMalloc_32f(m_halfFrames)) {
+, m_hammingTable(ippsMalloc_32f(m_halfFrames))
+, m_hilbert(ippsMalloc_32f(m_windowFrames)) {
   ippsZero_32f(m_inputBuf, m_windowFrames * 2 + m_halfFrames);
   ippsZero_32fc(m_outputBuf, m_windowFrames * 4);
+  ippsZero_32f(m_hilbert, m_windowFrames);
   m_output[0] = m_outputBuf;
   m_output[1] = m_output[0] + m_windowFrames;
   m_output[2] = m_output[1] + m_windowFrames;
@@ -105,6 +119,7 @@ WindowedHilbert::~WindowedHilbert() {
   ippsFree(m_inputBuf);
   ippsFree(m_outputBuf);
   ippsFree(m_hammingTable);
+  ippsFree(m_hilbert);
 }
 
 void WindowedHilbert::_AddWindow() {
@@ -124,6 +139,26 @@ void WindowedHilbert::_AddWindow() {
     ippsHilbert_32f32fc(&m_inputBuf[m_halfFrames], m_output[1], m_spec, m_buffer);
   }
   m_bufIdx ^= 1;
+
+  int first, middle, last;
+  if (m_bufIdx) {
+    first = 3;
+    middle = 0;
+    last = 1;
+  } else {
+    first = 1;
+    middle = 2;
+    last = 3;
+  }
+
+  int i, t;
+  for (i = 0, t = 0; i < m_halfFrames; ++i, ++t)
+    m_hilbert[i] =
+        m_output[first][m_halfFrames + i].im * (1.f - m_hammingTable[t]) + m_output[middle][i].im * m_hammingTable[t];
+  for (; i < m_windowFrames - m_halfFrames; ++i)
+    m_hilbert[i] = m_output[middle][i].im;
+  for (t = 0; i < m_windowFrames; ++i, ++t)
+    m_hilbert[i] = m_output[middle][i].im * (1.f - m_hammingTable[t]) + m_output[last][t].im * m_hammingTable[t];
 }
 
 void WindowedHilbert::AddWindow(const float* input, int stride) {
@@ -147,8 +182,90 @@ void WindowedHilbert::AddWindow(const int16_t* input, int stride) {
   _AddWindow();
 }
 
-template <typename T>
-void WindowedHilbert::Output(T* output, float lCoef, float rCoef) const {
+#else
+
+WindowedHilbert::WindowedHilbert(int windowFrames, double sampleRate)
+: m_windowFrames(windowFrames)
+, m_halfFrames(windowFrames / 2)
+, m_fftFrames(4)
+, m_inputBuf(new float[m_windowFrames * 2 + m_halfFrames]())
+, m_outputBuf(new float[m_windowFrames * 4]())
+, m_hammingTable(new float[m_halfFrames])
+, m_hilbert(new float[m_windowFrames]()) {
+  while (m_fftFrames < m_windowFrames)
+    m_fftFrames *= 2;
+  m_fftBuf.reset(new float[m_fftFrames]());
+  m_fftBitRev.reset(new int[2 + int(std::sqrt(m_fftFrames / 2)) + 1]());
+  m_fftTwiddle.reset(new float[m_fftFrames / 2]());
+
+  /* Build the FFT tables here rather than on the first mix */
+  _soxr_rdft_f(m_fftFrames, 1, m_fftBuf.get(), m_fftBitRev.get(), m_fftTwiddle.get());
+
+  m_output[0] = m_outputBuf.get();
+  m_output[1] = m_output[0] + m_windowFrames;
+  m_output[2] = m_output[1] + m_windowFrames;
+  m_output[3] = m_output[2] + m_windowFrames;
+
+  for (int i = 0; i < m_halfFrames; ++i)
+    m_hammingTable[i] = float(std::cos(M_PI * (i / double(m_halfFrames) + 1.0)) * 0.5 + 0.5);
+}
+
+void WindowedHilbert::_Transform(const float* input, float* output) {
+  float* buf = m_fftBuf.get();
+  std::copy(input, input + m_windowFrames, buf);
+  std::fill(buf + m_windowFrames, buf + m_fftFrames, 0.f);
+  _soxr_rdft_f(m_fftFrames, 1, buf, m_fftBitRev.get(), m_fftTwiddle.get());
+
+  /* Shift every positive-frequency bin by -90 degrees; bins are packed as (Re, -Im), so this is
+   * (a, b) -> (-b, a), folded together with the 2/N scale the unnormalized inverse requires */
+  const float scale = 2.f / m_fftFrames;
+  int i = 0;
+#if __SSE__
+  const __m128 coefs = _mm_setr_ps(-scale, scale, -scale, scale);
+  for (; i < m_fftFrames; i += 4) {
+    __m128 bins = _mm_loadu_ps(&buf[i]);
+    _mm_storeu_ps(&buf[i], _mm_mul_ps(_mm_shuffle_ps(bins, bins, _MM_SHUFFLE(2, 3, 0, 1)), coefs));
+  }
+#endif
+  for (; i < m_fftFrames; i += 2) {
+    float re = buf[i];
+    buf[i] = -buf[i + 1] * scale;
+    buf[i + 1] = re * scale;
+  }
+
+  /* DC and Nyquist (packed into buf[1]) have no quadrature component */
+  buf[0] = 0.f;
+  buf[1] = 0.f;
+  _soxr_rdft_f(m_fftFrames, -1, buf, m_fftBitRev.get(), m_fftTwiddle.get());
+  std::copy(buf, buf + m_windowFrames, output);
+}
+
+static void Crossfade(float* out, const float* from, const float* to, const float* fade, int frames) {
+  int i = 0;
+#if __SSE__
+  for (; i + 4 <= frames; i += 4) {
+    __m128 a = _mm_loadu_ps(&from[i]);
+    __m128 b = _mm_loadu_ps(&to[i]);
+    _mm_storeu_ps(&out[i], _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_loadu_ps(&fade[i]))));
+  }
+#endif
+  for (; i < frames; ++i)
+    out[i] = from[i] + (to[i] - from[i]) * fade[i];
+}
+
+void WindowedHilbert::_AddWindow() {
+  if (m_bufIdx) {
+    /* Mirror last half of samples to start of input buffer */
+    float* bufBase = &m_inputBuf[m_windowFrames * 2];
+    std::copy(bufBase, bufBase + m_halfFrames, m_inputBuf.get());
+    _Transform(&m_inputBuf[m_windowFrames], m_output[2]);
+    _Transform(&m_inputBuf[m_windowFrames + m_halfFrames], m_output[3]);
+  } else {
+    _Transform(&m_inputBuf[0], m_output[0]);
+    _Transform(&m_inputBuf[m_halfFrames], m_output[1]);
+  }
+  m_bufIdx ^= 1;
+
   int first, middle, last;
   if (m_bufIdx) {
     first = 3;
@@ -160,77 +277,42 @@ void WindowedHilbert::Output(T* output, float lCoef, float rCoef) const {
     last = 3;
   }
 
-#if 0
-    for (int i=0 ; i<m_windowFrames ; ++i)
-    {
-        float tmp = m_output[middle][i].im;
-        output[i*2] = ClampFull<T>(output[i*2] + tmp * lCoef);
-        output[i*2+1] = ClampFull<T>(output[i*2+1] + tmp * rCoef);
-    }
-    return;
-#endif
-
-  int i, t;
-  for (i = 0, t = 0; i < m_halfFrames; ++i, ++t) {
-    float tmp =
-        m_output[first][m_halfFrames + i].im * (1.f - m_hammingTable[t]) + m_output[middle][i].im * m_hammingTable[t];
-    output[i * 2] = ClampFull<T>(output[i * 2] + tmp * lCoef);
-    output[i * 2 + 1] = ClampFull<T>(output[i * 2 + 1] + tmp * rCoef);
-  }
-  for (; i < m_windowFrames - m_halfFrames; ++i) {
-    float tmp = m_output[middle][i].im;
-    output[i * 2] = ClampFull<T>(output[i * 2] + tmp * lCoef);
-    output[i * 2 + 1] = ClampFull<T>(output[i * 2 + 1] + tmp * rCoef);
-  }
-  for (t = 0; i < m_windowFrames; ++i, ++t) {
-    float tmp = m_output[middle][i].im * (1.f - m_hammingTable[t]) + m_output[last][t].im * m_hammingTable[t];
-    output[i * 2] = ClampFull<T>(output[i * 2] + tmp * lCoef);
-    output[i * 2 + 1] = ClampFull<T>(output[i * 2 + 1] + tmp * rCoef);
-  }
+  const int tailFrames = m_windowFrames - m_halfFrames;
+  Crossfade(m_hilbert.get(), m_output[first] + m_halfFrames, m_output[middle], m_hammingTable.get(), m_halfFrames);
+  std::copy(m_output[middle] + m_halfFrames, m_output[middle] + tailFrames, m_hilbert.get() + m_halfFrames);
+  Crossfade(m_hilbert.get() + tailFrames, m_output[middle] + tailFrames, m_output[last], m_hammingTable.get(),
+            m_halfFrames);
 }
 
-template void WindowedHilbert::Output<int16_t>(int16_t* output, float lCoef, float rCoef) const;
-template void WindowedHilbert::Output<int32_t>(int32_t* output, float lCoef, float rCoef) const;
-template void WindowedHilbert::Output<float>(float* output, float lCoef, float rCoef) const;
-
-#endif
-
-template <>
-int16_t* LtRtProcessing::_getInBuf<int16_t>() {
-  return m_16Buffer.get();
-}
-template <>
-int32_t* LtRtProcessing::_getInBuf<int32_t>() {
-  return m_32Buffer.get();
-}
-template <>
-float* LtRtProcessing::_getInBuf<float>() {
-  return m_fltBuffer.get();
+void WindowedHilbert::AddWindow(const float* input, int stride) {
+  float* bufBase = &m_inputBuf[m_windowFrames * m_bufIdx + m_halfFrames];
+  for (int i = 0; i < m_windowFrames; ++i)
+    bufBase[i] = input[i * stride];
+  _AddWindow();
 }
 
-template <>
-int16_t* LtRtProcessing::_getOutBuf<int16_t>() {
-  return m_16Buffer.get() + m_outputOffset;
-}
-template <>
-int32_t* LtRtProcessing::_getOutBuf<int32_t>() {
-  return m_32Buffer.get() + m_outputOffset;
+void WindowedHilbert::AddWindow(const int32_t* input, int stride) {
+  float* bufBase = &m_inputBuf[m_windowFrames * m_bufIdx + m_halfFrames];
+  for (int i = 0; i < m_windowFrames; ++i)
+    bufBase[i] = input[i * stride] / (float(INT32_MAX) + 1.f);
+  _AddWindow();
 }
-template <>
-float* LtRtProcessing::_getOutBuf<float>() {
-  return m_fltBuffer.get() + m_outputOffset;
+
+void WindowedHilbert::AddWindow(const int16_t* input, int stride) {
+  float* bufBase = &m_inputBuf[m_windowFrames * m_bufIdx + m_halfFrames];
+  for (int i = 0; i < m_windowFrames; ++i)
+    bufBase[i] = input[i * stride] / (float(INT16_MAX) + 1.f);
+  _AddWindow();
 }
 
+#endif
+
 LtRtProcessing::LtRtProcessing(int _5msFrames, const AudioVoiceEngineMixInfo& mixInfo)
 : m_inMixInfo(mixInfo)
 , m_windowFrames(_5msFrames * 4)
 , m_halfFrames(m_windowFrames / 2)
-, m_outputOffset(m_windowFrames * 5 * 2)
-#if INTEL_IPP
 , m_hilbertSL(m_windowFrames, mixInfo.m_sampleRate)
-, m_hilbertSR(m_windowFrames, mixInfo.m_sampleRate)
-#endif
-{
+, m_hilbertSR(m_windowFrames, mixInfo.m_sampleRate) {
   m_inMixInfo.m_channels = AudioChannelSet::Surround51;
   m_inMixInfo.m_channelMap.m_channelCount = 5;
   m_inMixInfo.m_channelMap.m_channels[0] = AudioChannel::FrontLeft;
@@ -239,108 +321,79 @@ LtRtProcessing::LtRtProcessing(int _5msFrames, const AudioVoiceEngineMixInfo& mi
   m_inMixInfo.m_channelMap.m_channels[3] = AudioChannel::RearLeft;
   m_inMixInfo.m_channelMap.m_channels[4] = AudioChannel::RearRight;
 
-  const int samples = m_windowFrames * (5 * 2 + 2 * 2);
+  size_t sampleSize;
   switch (mixInfo.m_sampleFormat) {
   case SOXR_INT16_I:
-    m_16Buffer = std::make_unique<int16_t[]>(samples);
+    sampleSize = sizeof(int16_t);
     break;
   case SOXR_INT32_I:
-    m_32Buffer = std::make_unique<int32_t[]>(samples);
+    sampleSize = sizeof(int32_t);
     break;
   case SOXR_FLOAT32_I:
-    m_fltBuffer = std::make_unique<float[]>(samples);
-    break;
   default:
+    sampleSize = sizeof(float);
     break;
   }
+  m_buffer.reset(new uint8_t[m_windowFrames * 2 * 5 * sampleSize]());
 }
 
 template <typename T>
-void LtRtProcessing::Process(const T* input, T* output, int frameCount) {
-#if 0
-  for (int i = 0; i < frameCount; ++i)
-  {
-    output[i * 2] = input[i * 5 + 3];
-    output[i * 2 + 1] = input[i * 5 + 4];
-  }
-  return;
-#endif
+T* LtRtProcessing::PrepareInput(int frameCount) {
+  T* in = &_getInBuf<T>()[m_bufferTail * 5];
+  std::fill(in, in + frameCount * 5, T(0));
+  return in;
+}
 
-  int outFramesRem = frameCount;
-  T* inBuf = _getInBuf<T>();
-  T* outBuf = _getOutBuf<T>();
-  int tail = std::min(m_windowFrames * 2, m_bufferTail + frameCount);
-  int samples = (tail - m_bufferTail) * 5;
-  memmove(&inBuf[m_bufferTail * 5], input, samples * sizeof(T));
-  // fmt::print("input {} to {}\n", tail - m_bufferTail, m_bufferTail);
-  input += samples;
-  frameCount -= tail - m_bufferTail;
-
-  int head = std::min(m_windowFrames * 2, m_bufferHead + outFramesRem);
-  samples = (head - m_bufferHead) * 2;
-  memmove(output, outBuf + m_bufferHead * 2, samples * sizeof(T));
-  // fmt::print("output {} from {}\n", head - m_bufferHead, m_bufferHead);
-  output += samples;
-  outFramesRem -= head - m_bufferHead;
-
-  int bufIdx = m_bufferTail / m_windowFrames;
-  if (tail / m_windowFrames > bufIdx) {
-    T* in = &inBuf[bufIdx * m_windowFrames * 5];
-    T* out = &outBuf[bufIdx * m_windowFrames * 2];
-#if INTEL_IPP
-    m_hilbertSL.AddWindow(in + 3, 5);
-    m_hilbertSR.AddWindow(in + 4, 5);
-#endif
+template int16_t* LtRtProcessing::PrepareInput<int16_t>(int frameCount);
+template int32_t* LtRtProcessing::PrepareInput<int32_t>(int frameCount);
+template float* LtRtProcessing::PrepareInput<float>(int frameCount);
 
-    // x(:,1) + sqrt(.5)*x(:,3) + sqrt(19/25)*x(:,4) + sqrt(6/25)*x(:,5)
-    // x(:,2) + sqrt(.5)*x(:,3) - sqrt(6/25)*x(:,4) - sqrt(19/25)*x(:,5)
-    if (bufIdx) {
-      int delayI = -m_halfFrames;
-      for (int i = 0; i < m_windowFrames; ++i, ++delayI) {
-        out[i * 2] = ClampFull<T>(in[delayI * 5] + 0.7071068f * in[delayI * 5 + 2]);
-        out[i * 2 + 1] = ClampFull<T>(in[delayI * 5 + 1] + 0.7071068f * in[delayI * 5 + 2]);
-        // fmt::print("in {} out {}\n", bufIdx * m_5msFrames + delayI, bufIdx * m_5msFrames + i);
-      }
-    } else {
-      int delayI = m_windowFrames * 2 - m_halfFrames;
-      int i;
-      for (i = 0; i < m_halfFrames; ++i, ++delayI) {
-        out[i * 2] = ClampFull<T>(in[delayI * 5] + 0.7071068f * in[delayI * 5 + 2]);
-        out[i * 2 + 1] = ClampFull<T>(in[delayI * 5 + 1] + 0.7071068f * in[delayI * 5 + 2]);
-        // fmt::print("in {} out {}\n", bufIdx * m_5msFrames + delayI, bufIdx * m_5msFrames + i);
-      }
-      delayI = 0;
-      for (; i < m_windowFrames; ++i, ++delayI) {
-        out[i * 2] = ClampFull<T>(in[delayI * 5] + 0.7071068f * in[delayI * 5 + 2]);
-        out[i * 2 + 1] = ClampFull<T>(in[delayI * 5 + 1] + 0.7071068f * in[delayI * 5 + 2]);
-        // fmt::print("in {} out {}\n", bufIdx * m_5msFrames + delayI, bufIdx * m_5msFrames + i);
-      }
+template <typename T>
+void LtRtProcessing::Process(T* output, int frameCount) {
+  const T* inBuf = _getInBuf<T>();
+  const int ringFrames = m_windowFrames * 2;
+  const int bufIdx = m_bufferTail / m_windowFrames;
+  const int offset = m_bufferTail % m_windowFrames;
+
+  /* Output trails the input by one window. Fronts are delayed a further half window to line up with
+   * the Hilbert output, which reaches into the window before last while offset < m_halfFrames. */
+  int delayI = (bufIdx ^ 1) * m_windowFrames + offset - m_halfFrames;
+  if (delayI < 0)
+    delayI += ringFrames;
+
+  const float* surL = m_hilbertSL.Output() + offset;
+  const float* surR = m_hilbertSR.Output() + offset;
+
+  // x(:,1) + sqrt(.5)*x(:,3) + sqrt(19/25)*x(:,4) + sqrt(6/25)*x(:,5)
+  // x(:,2) + sqrt(.5)*x(:,3) - sqrt(6/25)*x(:,4) - sqrt(19/25)*x(:,5)
+  int i = 0;
+  while (i < frameCount) {
+    const T* in = &inBuf[delayI * 5];
+    int runEnd = std::min(frameCount, i + ringFrames - delayI);
+    for (; i < runEnd; ++i, in += 5) {
+      T l = ClampFull<T>(in[0] + 0.7071068f * in[2]);
+      T r = ClampFull<T>(in[1] + 0.7071068f * in[2]);
+      l = ClampFull<T>(l + surL[i] * 0.8717798f);
+      r = ClampFull<T>(r + surL[i] * 0.4898979f);
+      output[i * 2] = ClampFull<T>(l + surR[i] * -0.4898979f);
+      output[i * 2 + 1] = ClampFull<T>(r + surR[i] * -0.8717798f);
     }
-#if INTEL_IPP
-    m_hilbertSL.Output(out, 0.8717798f, 0.4898979f);
-    m_hilbertSR.Output(out, -0.4898979f, -0.8717798f);
-#endif
-  }
-  m_bufferTail = (tail == m_windowFrames * 2) ? 0 : tail;
-  m_bufferHead = (head == m_windowFrames * 2) ? 0 : head;
-
-  if (frameCount) {
-    samples = frameCount * 5;
-    memmove(inBuf, input, samples * sizeof(T));
-    // fmt::print("input {} to {}\n", frameCount, 0);
-    m_bufferTail = frameCount;
+    delayI = 0;
   }
 
-  if (outFramesRem) {
-    samples = outFramesRem * 2;
-    memmove(output, outBuf, samples * sizeof(T));
-    // fmt::print("output {} from {}\n", outFramesRem, 0);
-    m_bufferHead = outFramesRem;
+  m_bufferTail += frameCount;
+  if (m_bufferTail % m_windowFrames == 0) {
+    /* Window complete; its output is emitted over the next window */
+    const T* in = &inBuf[bufIdx * m_windowFrames * 5];
+    m_hilbertSL.AddWindow(in + 3, 5);
+    m_hilbertSR.AddWindow(in + 4, 5);
+    if (m_bufferTail == ringFrames)
+      m_bufferTail = 0;
   }
 }
 
-template void LtRtProcessing::Process<int16_t>(const int16_t* input, int16_t* output, int frameCount);
-template void LtRtProcessing::Process<int32_t>(const int32_t* input, int32_t* output, int frameCount);
-template void LtRtProcessing::Process<float>(const float* input, float* output, int frameCount);
+template void LtRtProcessing::Process<int16_t>(int16_t* output, int frameCount);
+template void LtRtProcessing::Process<int32_t>(int32_t* output, int frameCount);
+template void LtRtProcessing::Process<float>(float* output, int frameCount);
 
 } // namespace boo
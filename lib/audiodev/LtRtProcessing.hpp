@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 
@@ -42,6 +43,7 @@ class WindowedHilbert {
   Ipp32fc* m_outputBuf;
   Ipp32fc* m_output[4];
   Ipp32f* m_hammingTable;
+  Ipp32f* m_hilbert; /* Crossfaded output of the most recent window */
   void _AddWindow();
 
 public:
@@ -50,33 +52,70 @@ public:
   void AddWindow(const float* input, int stride);
   void AddWindow(const int32_t* input, int stride);
   void AddWindow(const int16_t* input, int stride);
-  template <typename T>
-  void Output(T* output, float lCoef, float rCoef) const;
+  /** Phase-shifted samples of the most recent window, delayed by half a window */
+  const float* Output() const { return m_hilbert; }
+};
+#else
+/** Portable counterpart of the IPP Hilbert transformer, built on soxr's real FFT.
+ *  Windows are zero-padded to the next power of two for the transform; the overlap and
+ *  crossfade scheme is identical so the two implementations are interchangeable. */
+class WindowedHilbert {
+  int m_windowFrames, m_halfFrames;
+  int m_fftFrames;
+  int m_bufIdx = 0;
+  std::unique_ptr<float[]> m_inputBuf;
+  std::unique_ptr<float[]> m_outputBuf;
+  float* m_output[4];
+  std::unique_ptr<float[]> m_hammingTable;
+  std::unique_ptr<float[]> m_fftBuf;
+  std::unique_ptr<int[]> m_fftBitRev;
+  std::unique_ptr<float[]> m_fftTwiddle;
+  std::unique_ptr<float[]> m_hilbert; /* Crossfaded output of the most recent window */
+  void _Transform(const float* input, float* output);
+  void _AddWindow();
+
+public:
+  explicit WindowedHilbert(int windowFrames, double sampleRate);
+  void AddWindow(const float* input, int stride);
+  void AddWindow(const int32_t* input, int stride);
+  void AddWindow(const int16_t* input, int stride);
+  /** Phase-shifted samples of the most recent window, delayed by half a window */
+  const float* Output() const { return m_hilbert.get(); }
 };
 #endif
 
+/** Encodes the 5-channel main mix down to Lt/Rt stereo in 20ms windows.
+ *  The main submix mixes straight into a two-window input ring (PrepareInput), and Process writes
+ *  the encoded stereo into the caller's output, trailing the input by one window. */
 class LtRtProcessing {
   AudioVoiceEngineMixInfo m_inMixInfo;
   int m_windowFrames;
   int m_halfFrames;
-  int m_outputOffset;
   int m_bufferTail = 0;
-  int m_bufferHead = 0;
-  std::unique_ptr<int16_t[]> m_16Buffer;
-  std::unique_ptr<int32_t[]> m_32Buffer;
-  std::unique_ptr<float[]> m_fltBuffer;
-#if INTEL_IPP
+  std::unique_ptr<uint8_t[]> m_buffer;
   WindowedHilbert m_hilbertSL, m_hilbertSR;
-#endif
-  template <typename T>
-  T* _getInBuf();
   template <typename T>
-  T* _getOutBuf();
+  T* _getInBuf() {
+    return reinterpret_cast<T*>(m_buffer.get());
+  }
 
 public:
   LtRtProcessing(int _5msFrames, const AudioVoiceEngineMixInfo& mixInfo);
+
+  /** Frames that may be mixed at once: no further than the end of the current window, and no more than half a
+   *  window, beyond which Process would read delayed fronts from the span being mixed */
+  int ContiguousFrames() const {
+    return std::min(m_windowFrames - m_bufferTail % m_windowFrames, m_halfFrames);
+  }
+
+  /** Zeroed span of the input ring to mix frameCount frames into (at most ContiguousFrames()) */
   template <typename T>
-  void Process(const T* input, T* output, int frameCount);
+  T* PrepareInput(int frameCount);
+
+  /** Encode the frames last mixed into PrepareInput's span as interleaved stereo */
+  template <typename T>
+  void Process(T* output, int frameCount);
+
   const AudioVoiceEngineMixInfo& inMixInfo() const { return m_inMixInfo; }
 };
 
@@ -0,0 +1,198 @@
+#include "lib/audiodev/AudioVoiceEngine.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "boo/audiodev/IAudioVoiceEngine.hpp"
+#include <optick.h>
+
+namespace boo {
+
+/* Offline renders mix this many 5ms blocks per call into the mixer */
+constexpr size_t NullRenderBlockPeriods = 200;
+
+/* FNV-1a parameters for the output checksum */
+constexpr uint64_t ChecksumOffsetBasis = 0xcbf29ce484222325;
+constexpr uint64_t ChecksumPrime = 0x100000001b3;
+
+/** Device-less engine: mixes on demand at the requested rate, channel count and sample format, then
+ *  discards (and optionally hashes) the result. Mix time advances only with pumpAndMixVoices and
+ *  renderFrames calls, so renders are deterministic and independent of wall-clock timing. */
+struct NullAudioVoiceEngine : BaseAudioVoiceEngine {
+  bool m_checksum;
+  uint64_t m_hash = ChecksumOffsetBasis;
+  std::vector<int16_t> m_mixBuf16;
+  std::vector<int32_t> m_mixBuf32;
+  std::vector<float> m_mixBufFlt;
+
+  std::string getCurrentAudioOutput() const override { return "null"; }
+
+  bool setCurrentAudioOutput(const char* name) override { return false; }
+
+  std::vector<std::pair<std::string, std::string>> enumerateAudioOutputs() const override {
+    return {{"null", "Null Output"}};
+  }
+
+  std::vector<std::pair<std::string, std::string>> enumerateMIDIInputs() const override { return {}; }
+
+  bool supportsVirtualMIDIIn() const override { return false; }
+
+  std::unique_ptr<IMIDIIn> newVirtualMIDIIn(ReceiveFunctor&& receiver) override { return {}; }
+
+  std::unique_ptr<IMIDIOut> newVirtualMIDIOut() override { return {}; }
+
+  std::unique_ptr<IMIDIInOut> newVirtualMIDIInOut(ReceiveFunctor&& receiver) override { return {}; }
+
+  std::unique_ptr<IMIDIIn> newRealMIDIIn(const char* name, ReceiveFunctor&& receiver) override { return {}; }
+
+  std::unique_ptr<IMIDIOut> newRealMIDIOut(const char* name) override { return {}; }
+
+  std::unique_ptr<IMIDIInOut> newRealMIDIInOut(const char* name, ReceiveFunctor&& receiver) override { return {}; }
+
+  bool useMIDILock() const override { return false; }
+
+  NullAudioVoiceEngine(double sampleRate, int numChans, SubmixFormat format, bool checksum) : m_checksum(checksum) {
+    ChannelMap& chMap = m_mixInfo.m_channelMap;
+    switch (numChans) {
+    default:
+    case 2:
+      m_mixInfo.m_channels = AudioChannelSet::Stereo;
+      chMap.m_channelCount = 2;
+      chMap.m_channels[0] = AudioChannel::FrontLeft;
+      chMap.m_channels[1] = AudioChannel::FrontRight;
+      break;
+    case 4:
+      m_mixInfo.m_channels = AudioChannelSet::Quad;
+      chMap.m_channelCount = 4;
+      chMap.m_channels[0] = AudioChannel::FrontLeft;
+      chMap.m_channels[1] = AudioChannel::FrontRight;
+      chMap.m_channels[2] = AudioChannel::RearLeft;
+      chMap.m_channels[3] = AudioChannel::RearRight;
+      break;
+    case 6:
+      m_mixInfo.m_channels = AudioChannelSet::Surround51;
+      chMap.m_channelCount = 6;
+      chMap.m_channels[0] = AudioChannel::FrontLeft;
+      chMap.m_channels[1] = AudioChannel::FrontRight;
+      chMap.m_channels[2] = AudioChannel::FrontCenter;
+      chMap.m_channels[3] = AudioChannel::LFE;
+      chMap.m_channels[4] = AudioChannel::RearLeft;
+      chMap.m_channels[5] = AudioChannel::RearRight;
+      break;
+    case 8:
+      m_mixInfo.m_channels = AudioChannelSet::Surround71;
+      chMap.m_channelCount = 8;
+      chMap.m_channels[0] = AudioChannel::FrontLeft;
+      chMap.m_channels[1] = AudioChannel::FrontRight;
+      chMap.m_channels[2] = AudioChannel::FrontCenter;
+      chMap.m_channels[3] = AudioChannel::LFE;
+      chMap.m_channels[4] = AudioChannel::RearLeft;
+      chMap.m_channels[5] = AudioChannel::RearRight;
+      chMap.m_channels[6] = AudioChannel::SideLeft;
+      chMap.m_channels[7] = AudioChannel::SideRight;
+      break;
+    }
+
+    switch (format) {
+    case SubmixFormat::Int16:
+      m_mixInfo.m_sampleFormat = SOXR_INT16_I;
+      m_mixInfo.m_bitsPerSample = 16;
+      break;
+    case SubmixFormat::Int32:
+      m_mixInfo.m_sampleFormat = SOXR_INT32_I;
+      m_mixInfo.m_bitsPerSample = 32;
+      break;
+    case SubmixFormat::Float:
+    default:
+      m_mixInfo.m_sampleFormat = SOXR_FLOAT32_I;
+      m_mixInfo.m_bitsPerSample = 32;
+      break;
+    }
+
+    m_mixInfo.m_sampleRate = sampleRate;
+    m_5msFrames = size_t(sampleRate * 5 / 1000);
+    m_mixInfo.m_periodFrames = m_5msFrames;
+  }
+
+  template <typename T>
+  std::vector<T>& _getMixBuf() {
+    if constexpr (std::is_same_v<T, int16_t>)
+      return m_mixBuf16;
+    else if constexpr (std::is_same_v<T, int32_t>)
+      return m_mixBuf32;
+    else
+      return m_mixBufFlt;
+  }
+
+  template <typename T>
+  void _mixFrames(size_t frames) {
+    std::vector<T>& buf = _getMixBuf<T>();
+    size_t samples = frames * m_mixInfo.m_channelMap.m_channelCount;
+    if (buf.size() < samples)
+      buf.resize(samples);
+    _pumpAndMixVoices(frames, buf.data());
+
+    if (!m_checksum)
+      return;
+    for (size_t s = 0; s < samples; ++s) {
+      std::make_unsigned_t<std::conditional_t<std::is_same_v<T, float>, int32_t, T>> bits;
+      memcpy(&bits, &buf[s], sizeof(T));
+      m_hash = (m_hash ^ bits) * ChecksumPrime;
+    }
+  }
+
+  void _mix(size_t frames) {
+    switch (m_mixInfo.m_sampleFormat) {
+    case SOXR_INT16_I:
+      _mixFrames<int16_t>(frames);
+      break;
+    case SOXR_INT32_I:
+      _mixFrames<int32_t>(frames);
+      break;
+    case SOXR_FLOAT32_I:
+    default:
+      _mixFrames<float>(frames);
+      break;
+    }
+  }
+
+  void pumpAndMixVoices() override {
+    OPTICK_EVENT();
+    _mix(m_5msFrames);
+  }
+
+  AudioRenderStats renderFrames(size_t frames) override {
+    OPTICK_EVENT();
+    AudioRenderStats stats;
+    size_t blockFrames = m_5msFrames * NullRenderBlockPeriods;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t remFrames = frames;
+    while (remFrames) {
+      size_t thisFrames = std::min(remFrames, blockFrames);
+      _mix(thisFrames);
+      remFrames -= thisFrames;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    stats.m_frames = frames;
+    stats.m_wallSeconds = elapsed.count();
+    if (stats.m_wallSeconds > 0.0) {
+      stats.m_framesPerSecond = frames / stats.m_wallSeconds;
+      stats.m_realtimeFactor = stats.m_framesPerSecond / m_mixInfo.m_sampleRate;
+    }
+    if (m_checksum)
+      stats.m_checksum = m_hash;
+    return stats;
+  }
+};
+
+std::unique_ptr<IAudioVoiceEngine> NewNullAudioVoiceEngine(double sampleRate, int numChans, SubmixFormat format,
+                                                           bool checksum) {
+  return std::make_unique<NullAudioVoiceEngine>(sampleRate, numChans, format, checksum);
+}
+
+} // namespace boo
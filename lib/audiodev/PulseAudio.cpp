@@ -3,8 +3,19 @@
 #include "boo/boo.hpp"
 #include "lib/audiodev/LinuxMidi.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
 #include <logvisor/logvisor.hpp>
+#include <poll.h>
+#include <pthread.h>
 #include <pulse/pulseaudio.h>
+#include <sched.h>
 #include <unistd.h>
 
 namespace boo {
@@ -25,6 +36,9 @@ static const uint64_t S71Chans = (1 << PA_CHANNEL_POSITION_FRONT_LEFT) | (1 << P
                                  (1 << PA_CHANNEL_POSITION_FRONT_CENTER) | (1 << PA_CHANNEL_POSITION_LFE) |
                                  (1 << PA_CHANNEL_POSITION_SIDE_LEFT) | (1 << PA_CHANNEL_POSITION_SIDE_RIGHT);
 
+/* Server-side buffering in periods (minreq) when the engine renders from its own thread */
+static constexpr uint32_t RealtimeBufferPeriods = 4;
+
 struct PulseAudioVoiceEngine : LinuxMidi {
   pa_mainloop* m_mainloop = nullptr;
   pa_context* m_ctx = nullptr;
@@ -34,25 +48,40 @@ struct PulseAudioVoiceEngine : LinuxMidi {
   pa_sample_spec m_sampleSpec = {};
   pa_channel_map m_chanMap = {};
 
-  int _paWaitReady() {
+  /* Realtime mode: m_rtThread owns the mainloop and holds m_paMutex except while polling.
+   * Client threads lock m_paMutex and sleep on m_paCond until the thread has dispatched their replies. */
+  bool m_realtime = false;
+  bool m_retryWrite = false;
+  std::thread m_rtThread;
+  std::atomic_bool m_rtStop = false;
+  mutable std::recursive_mutex m_paMutex;
+  mutable std::condition_variable_any m_paCond;
+
+  bool _onRealtimeThread() const { return std::this_thread::get_id() == m_rtThread.get_id(); }
+
+  template <class Pred>
+  int _paWaitWhile(Pred pred) const {
     int retval = 0;
-    while (pa_context_get_state(m_ctx) < PA_CONTEXT_READY)
+    if (m_rtThread.joinable() && !_onRealtimeThread()) {
+      while (pred())
+        m_paCond.wait(m_paMutex);
+      return retval;
+    }
+    while (pred())
       pa_mainloop_iterate(m_mainloop, 1, &retval);
     return retval;
   }
 
+  int _paWaitReady() {
+    return _paWaitWhile([this]() { return pa_context_get_state(m_ctx) < PA_CONTEXT_READY; });
+  }
+
   int _paStreamWaitReady() {
-    int retval = 0;
-    while (pa_stream_get_state(m_stream) < PA_STREAM_READY)
-      pa_mainloop_iterate(m_mainloop, 1, &retval);
-    return retval;
+    return _paWaitWhile([this]() { return pa_stream_get_state(m_stream) < PA_STREAM_READY; });
   }
 
   int _paIterate(pa_operation* op) const {
-    int retval = 0;
-    while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
-      pa_mainloop_iterate(m_mainloop, 1, &retval);
-    return retval;
+    return _paWaitWhile([op]() { return pa_operation_get_state(op) == PA_OPERATION_RUNNING; });
   }
 
   bool _setupSink() {
@@ -87,18 +116,22 @@ struct PulseAudioVoiceEngine : LinuxMidi {
     pa_buffer_attr bufAttr;
     bufAttr.minreq = uint32_t(m_5msFrames * m_sampleSpec.channels * sizeof(float));
     bufAttr.maxlength = bufAttr.minreq * 24;
-    bufAttr.tlength = bufAttr.maxlength;
+    bufAttr.tlength = m_realtime ? bufAttr.minreq * RealtimeBufferPeriods : bufAttr.maxlength;
     bufAttr.prebuf = UINT32_MAX;
     bufAttr.fragsize = UINT32_MAX;
 
+    /* A dedicated thread answers requests promptly, so the server may size the sink latency to tlength */
     if (pa_stream_connect_playback(m_stream, m_sinkName.c_str(), &bufAttr,
-                                   pa_stream_flags_t(PA_STREAM_START_UNMUTED | PA_STREAM_EARLY_REQUESTS), nullptr,
-                                   nullptr)) {
+                                   pa_stream_flags_t(PA_STREAM_START_UNMUTED | PA_STREAM_EARLY_REQUESTS |
+                                                     PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_INTERPOLATE_TIMING |
+                                                     (m_realtime ? PA_STREAM_ADJUST_LATENCY : 0)),
+                                   nullptr, nullptr)) {
       Log.report(logvisor::Error, FMT_STRING("Unable to pa_stream_connect_playback()"));
       goto err;
     }
 
     pa_stream_set_moved_callback(m_stream, pa_stream_notify_cb_t(_streamMoved), this);
+    pa_stream_set_underflow_callback(m_stream, pa_stream_notify_cb_t(_streamUnderflow), this);
 
     _paStreamWaitReady();
 
@@ -157,6 +190,7 @@ struct PulseAudioVoiceEngine : LinuxMidi {
   }
 
   ~PulseAudioVoiceEngine() override {
+    _stopRealtimeThread();
     if (m_stream) {
       pa_stream_disconnect(m_stream);
       pa_stream_unref(m_stream);
@@ -175,6 +209,8 @@ struct PulseAudioVoiceEngine : LinuxMidi {
     userdata->m_handleMove = true;
   }
 
+  static void _streamUnderflow(pa_stream* p, PulseAudioVoiceEngine* userdata) { userdata->_reportUnderrun(); }
+
   static void _getServerInfoReply(pa_context* c, const pa_server_info* i, PulseAudioVoiceEngine* userdata) {
     userdata->m_sinkName = i->default_sink_name;
   }
@@ -273,6 +309,7 @@ struct PulseAudioVoiceEngine : LinuxMidi {
       userdata->m_sinks.push_back(std::make_pair(i->name, i->description));
   }
   std::vector<std::pair<std::string, std::string>> enumerateAudioOutputs() const override {
+    std::unique_lock lk(m_paMutex);
     pa_operation* op = pa_context_get_sink_info_list(m_ctx, pa_sink_info_cb_t(_getSinkInfoListReply), (void*)this);
     _paIterate(op);
     pa_operation_unref(op);
@@ -281,7 +318,10 @@ struct PulseAudioVoiceEngine : LinuxMidi {
     return ret;
   }
 
-  std::string getCurrentAudioOutput() const override { return m_sinkName; }
+  std::string getCurrentAudioOutput() const override {
+    std::unique_lock lk(m_paMutex);
+    return m_sinkName;
+  }
 
   bool m_sinkOk = false;
   static void _checkAudioSinkReply(pa_context* c, const pa_sink_info* i, int eol, PulseAudioVoiceEngine* userdata) {
@@ -289,6 +329,7 @@ struct PulseAudioVoiceEngine : LinuxMidi {
       userdata->m_sinkOk = true;
   }
   bool setCurrentAudioOutput(const char* name) override {
+    std::unique_lock lk(m_paMutex);
     m_sinkOk = false;
     pa_operation* op;
     op = pa_context_get_sink_info_by_name(m_ctx, name, pa_sink_info_cb_t(_checkAudioSinkReply), this);
@@ -301,40 +342,36 @@ struct PulseAudioVoiceEngine : LinuxMidi {
     return false;
   }
 
-  void _doIterate() {
+  /* Blocks until the next event, or at most timeoutUsec when non-negative */
+  void _doIterate(int timeoutUsec = -1) {
     int retval;
-    pa_mainloop_iterate(m_mainloop, 1, &retval);
+    if (timeoutUsec < 0)
+      pa_mainloop_iterate(m_mainloop, 1, &retval);
+    else if (pa_mainloop_prepare(m_mainloop, timeoutUsec) >= 0 && pa_mainloop_poll(m_mainloop) >= 0)
+      pa_mainloop_dispatch(m_mainloop);
     if (m_handleMove) {
       m_handleMove = false;
       _setupSink();
     }
   }
 
-  void pumpAndMixVoices() override {
-    if (!m_stream) {
-      /* Dummy pump mode - use failsafe defaults for 1/60sec of samples */
-      m_mixInfo.m_sampleRate = 32000.0;
-      m_mixInfo.m_sampleFormat = SOXR_FLOAT32_I;
-      m_mixInfo.m_bitsPerSample = 32;
-      m_5msFrames = 32000 / 60;
-      m_mixInfo.m_periodFrames = m_5msFrames;
-      m_mixInfo.m_channels = AudioChannelSet::Stereo;
-      m_mixInfo.m_channelMap.m_channelCount = 2;
-      m_mixInfo.m_channelMap.m_channels[0] = AudioChannel::FrontLeft;
-      m_mixInfo.m_channelMap.m_channels[1] = AudioChannel::FrontRight;
-      _pumpAndMixVoices(m_5msFrames, (float*)nullptr);
-      return;
-    }
+  /* Render as many whole periods as the server will accept */
+  void _writePeriods() {
+    m_retryWrite = false;
+
+    /* Interpolated from the automatic timing updates; fails with PA_ERR_NODATA until the first one arrives */
+    pa_usec_t latency;
+    int negative;
+    if (!pa_stream_get_latency(m_stream, &latency, &negative))
+      _setDeviceLatency(negative ? 0.0 : latency / 1.0e6);
 
     size_t writableSz = pa_stream_writable_size(m_stream);
     size_t frameSz = m_mixInfo.m_channelMap.m_channelCount * sizeof(float);
     size_t writableFrames = writableSz / frameSz;
     size_t writablePeriods = writableFrames / m_mixInfo.m_periodFrames;
 
-    if (!writablePeriods) {
-      _doIterate();
+    if (!writablePeriods)
       return;
-    }
 
     void* data = nullptr;
     size_t periodSz = m_mixInfo.m_periodFrames * frameSz;
@@ -342,20 +379,146 @@ struct PulseAudioVoiceEngine : LinuxMidi {
     if (pa_stream_begin_write(m_stream, &data, &nbytes)) {
       pa_stream_state_t st = pa_stream_get_state(m_stream);
       Log.report(logvisor::Error, FMT_STRING("Unable to pa_stream_begin_write(): {} {}"), pa_strerror(pa_context_errno(m_ctx)), st);
-      _doIterate();
       return;
     }
 
     writablePeriods = nbytes / periodSz;
-    _pumpAndMixVoices(m_mixInfo.m_periodFrames * writablePeriods, reinterpret_cast<float*>(data));
+    if (m_realtime) {
+      /* Clients create, destroy and reconfigure voices and submixes under m_dataMutex. Rather than wait for
+       * them on the realtime thread, hand the buffer back and retry shortly; only once the server is down to
+       * its last period is a single period of silence written to hold off the underrun. */
+      std::unique_lock dataLk(m_dataMutex, std::try_to_lock);
+      if (dataLk) {
+        _pumpAndMixVoices(m_mixInfo.m_periodFrames * writablePeriods, reinterpret_cast<float*>(data));
+      } else {
+        const pa_buffer_attr* attr = pa_stream_get_buffer_attr(m_stream);
+        size_t queuedSz = attr && attr->tlength > writableSz ? attr->tlength - writableSz : 0;
+        if (queuedSz > periodSz) {
+          pa_stream_cancel_write(m_stream);
+          m_retryWrite = true;
+          return;
+        }
+        memset(data, 0, periodSz);
+        nbytes = periodSz;
+      }
+    } else {
+      _pumpAndMixVoices(m_mixInfo.m_periodFrames * writablePeriods, reinterpret_cast<float*>(data));
+    }
 
     if (pa_stream_write(m_stream, data, nbytes, nullptr, 0, PA_SEEK_RELATIVE))
       Log.report(logvisor::Error, FMT_STRING("Unable to pa_stream_write()"));
+  }
+
+  /* Mainloop poll hook for the realtime thread; lets client threads use the context while it sleeps */
+  static int _realtimePoll(struct pollfd* ufds, unsigned long nfds, int timeout, void* userdata) {
+    auto* self = static_cast<PulseAudioVoiceEngine*>(userdata);
+    self->m_paMutex.unlock();
+    int ret = poll(ufds, nfds, timeout);
+    self->m_paMutex.lock();
+    return ret;
+  }
+
+  static void _setRealtimePriority() {
+    sched_param param = {};
+    param.sched_priority = std::clamp(10, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+    if (int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+      Log.report(logvisor::Warning, FMT_STRING("Unable to schedule audio thread as SCHED_FIFO ({}); "
+                                               "running at normal priority"),
+                 strerror(err));
+  }
+
+  void _realtimeThreadProc() {
+    logvisor::RegisterThreadName("Boo Audio");
+    _setRealtimePriority();
+
+    std::unique_lock lk(m_paMutex);
+    while (!m_rtStop.load(std::memory_order_relaxed)) {
+      /* A write handed back under contention is retried a quarter period later */
+      _doIterate(m_retryWrite ? int(m_mixInfo.m_periodFrames * 250000 / m_mixInfo.m_sampleRate) : -1);
+      if (m_stream)
+        _writePeriods();
+      m_paCond.notify_all();
+    }
+  }
+
+  void _startRealtimeThread() {
+    pa_mainloop_set_poll_func(m_mainloop, _realtimePoll, this);
+    m_rtStop.store(false, std::memory_order_relaxed);
+    m_rtThread = std::thread(&PulseAudioVoiceEngine::_realtimeThreadProc, this);
+  }
+
+  void _stopRealtimeThread() {
+    if (!m_rtThread.joinable())
+      return;
+    m_rtStop.store(true, std::memory_order_relaxed);
+    pa_mainloop_wakeup(m_mainloop);
+    m_rtThread.join();
+    pa_mainloop_set_poll_func(m_mainloop, nullptr, nullptr);
+  }
+
+  bool setRealtimeThread(bool enable) override {
+    if (enable == m_realtime)
+      return true;
+    if (enable && !m_stream)
+      return false;
+
+    _stopRealtimeThread();
+    m_realtime = enable;
+    if (!_setupSink()) {
+      if (!enable)
+        return false;
+      /* Fall back to client pumping with the regular buffer size */
+      m_realtime = false;
+      _setupSink();
+      return false;
+    }
+    if (m_realtime)
+      _startRealtimeThread();
+    return true;
+  }
 
+  void pumpAndMixVoices() override {
+    if (m_realtime)
+      return;
+
+    if (!m_stream) {
+      /* Dummy pump mode - use failsafe defaults for 1/60sec of samples */
+      m_mixInfo.m_sampleRate = 32000.0;
+      m_mixInfo.m_sampleFormat = SOXR_FLOAT32_I;
+      m_mixInfo.m_bitsPerSample = 32;
+      m_5msFrames = 32000 / 60;
+      m_mixInfo.m_periodFrames = m_5msFrames;
+      m_mixInfo.m_channels = AudioChannelSet::Stereo;
+      m_mixInfo.m_channelMap.m_channelCount = 2;
+      m_mixInfo.m_channelMap.m_channels[0] = AudioChannel::FrontLeft;
+      m_mixInfo.m_channelMap.m_channels[1] = AudioChannel::FrontRight;
+      _pumpAndMixVoices(m_5msFrames, (float*)nullptr);
+      return;
+    }
+
+    _writePeriods();
     _doIterate();
   }
 };
 
-std::unique_ptr<IAudioVoiceEngine> NewAudioVoiceEngine() { return std::make_unique<PulseAudioVoiceEngine>(); }
+/* Defined in ALSA.cpp; returns empty if the PCM cannot be opened (nullptr selects "default") */
+std::unique_ptr<IAudioVoiceEngine> NewALSAAudioVoiceEngine(const char* device);
+
+std::unique_ptr<IAudioVoiceEngine> NewAudioVoiceEngine() {
+  /* BOO_AUDIO_DRIVER=alsa opens BOO_ALSA_DEVICE directly instead of going through the sound server;
+   * ALSA is otherwise tried when no server is reachable, unless BOO_AUDIO_DRIVER=pulse */
+  const char* driver = getenv("BOO_AUDIO_DRIVER");
+  if (driver && !strcmp(driver, "alsa"))
+    if (auto ret = NewALSAAudioVoiceEngine(getenv("BOO_ALSA_DEVICE")))
+      return ret;
+
+  auto ret = std::make_unique<PulseAudioVoiceEngine>();
+  if (!ret->m_stream && !(driver && !strcmp(driver, "pulse"))) {
+    Log.report(logvisor::Warning, FMT_STRING("No PulseAudio server available; trying ALSA"));
+    if (auto alsa = NewALSAAudioVoiceEngine(getenv("BOO_ALSA_DEVICE")))
+      return alsa;
+  }
+  return ret;
+}
 
 } // namespace boo
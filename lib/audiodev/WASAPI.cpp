@@ -378,6 +378,7 @@ struct WASAPIAudioVoiceEngine : BaseAudioVoiceEngine {
 
   bool m_started = false;
   bool m_rebuild = false;
+  bool m_primed = false;
 
   void _rebuildAudioRenderClient() {
     soxr_datatype_t oldFmt = m_mixInfo.m_sampleFormat;
@@ -385,6 +386,7 @@ struct WASAPIAudioVoiceEngine : BaseAudioVoiceEngine {
     _buildAudioRenderClient();
     m_rebuild = false;
     m_started = false;
+    m_primed = false;
 
     if (m_mixInfo.m_sampleFormat != oldFmt)
       Log.report(logvisor::Fatal, FMT_STRING("audio device sample format changed, boo doesn't support this!!"));
@@ -431,6 +433,11 @@ struct WASAPIAudioVoiceEngine : BaseAudioVoiceEngine {
         continue;
       }
 
+      /* Queued frames are the device latency; an empty queue after a write means the device starved */
+      _setDeviceLatency(numFramesPadding / m_mixInfo.m_sampleRate);
+      if (!numFramesPadding && m_primed)
+        _reportUnderrun();
+
       size_t frames = m_mixInfo.m_periodFrames - numFramesPadding;
       if (frames <= 0)
         return;
@@ -465,6 +472,7 @@ struct WASAPIAudioVoiceEngine : BaseAudioVoiceEngine {
         ++attempt;
         continue;
       }
+      m_primed = true;
 
       break;
     }
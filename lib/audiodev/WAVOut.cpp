@@ -1,6 +1,14 @@
 #include "lib/audiodev/AudioVoiceEngine.hpp"
+#include "lib/audiodev/AudioQuantize.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <thread>
 
 #include "boo/audiodev/IAudioVoiceEngine.hpp"
 #include <logvisor/logvisor.hpp>
@@ -11,8 +19,103 @@ namespace boo {
 
 static logvisor::Module Log("boo::WAVOut");
 
+/* Offline renders mix this many 5ms blocks per write */
+constexpr size_t RenderBlockPeriods = 200;
+
+/* Blocks in flight between the mixing thread and the disk thread */
+constexpr size_t WriterBlockCount = 4;
+
+/** Hands fixed-size, pre-allocated blocks from the mixing thread to a background disk thread.
+ *  Publication is a single-producer/single-consumer ring of block indices; the mixer only
+ *  blocks if every block is still waiting to be written. */
+class WAVOutWriter {
+  struct Block {
+    std::unique_ptr<uint8_t[]> m_data;
+    size_t m_size = 0;
+  };
+  FILE* m_fp;
+  size_t m_blockBytes;
+  size_t m_curFill = 0;
+  std::array<Block, WriterBlockCount> m_blocks;
+  std::atomic_size_t m_readIdx = 0;
+  std::atomic_size_t m_writeIdx = 0;
+  std::thread m_thread;
+
+  /* Set in m_writeIdx together with the last block, so the disk thread learns of the end in the same
+   * load that reveals the block; nothing is published after it */
+  static constexpr size_t FinalBlock = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+  void _run() {
+    logvisor::RegisterThreadName("Boo WAVOut");
+    size_t readIdx = 0;
+    while (true) {
+      size_t published = m_writeIdx.load(std::memory_order_acquire);
+      if (readIdx == (published & ~FinalBlock)) {
+        if (published & FinalBlock)
+          break;
+        m_writeIdx.wait(published, std::memory_order_acquire);
+        continue;
+      }
+      const Block& block = m_blocks[readIdx % WriterBlockCount];
+      fwrite(block.m_data.get(), 1, block.m_size, m_fp);
+      m_readIdx.store(++readIdx, std::memory_order_release);
+      m_readIdx.notify_one();
+    }
+  }
+
+  /* Wait on the disk thread until the block at writeIdx is free */
+  void _waitForSpace(size_t writeIdx) {
+    size_t readIdx = m_readIdx.load(std::memory_order_acquire);
+    while (writeIdx - readIdx == WriterBlockCount) {
+      m_readIdx.wait(readIdx, std::memory_order_acquire);
+      readIdx = m_readIdx.load(std::memory_order_acquire);
+    }
+  }
+
+  void _publish(bool final = false) {
+    size_t writeIdx = m_writeIdx.load(std::memory_order_relaxed);
+    m_blocks[writeIdx % WriterBlockCount].m_size = m_curFill;
+    m_curFill = 0;
+    m_writeIdx.store((writeIdx + 1) | (final ? FinalBlock : 0), std::memory_order_release);
+    m_writeIdx.notify_one();
+  }
+
+public:
+  WAVOutWriter(FILE* fp, size_t blockBytes) : m_fp(fp), m_blockBytes(blockBytes) {
+    for (Block& block : m_blocks)
+      block.m_data = std::make_unique<uint8_t[]>(blockBytes);
+    m_thread = std::thread(&WAVOutWriter::_run, this);
+  }
+
+  ~WAVOutWriter() { finish(); }
+
+  /* Returns unfilled remainder of the current block, waiting on the disk thread if the ring is full */
+  uint8_t* beginWrite(size_t& bytesAvail) {
+    size_t writeIdx = m_writeIdx.load(std::memory_order_relaxed);
+    _waitForSpace(writeIdx);
+    bytesAvail = m_blockBytes - m_curFill;
+    return m_blocks[writeIdx % WriterBlockCount].m_data.get() + m_curFill;
+  }
+
+  void endWrite(size_t bytes) {
+    m_curFill += bytes;
+    if (m_curFill == m_blockBytes)
+      _publish();
+  }
+
+  /* Write out partially filled block and wait for the disk thread to drain */
+  void finish() {
+    if (!m_thread.joinable())
+      return;
+    _waitForSpace(m_writeIdx.load(std::memory_order_relaxed));
+    _publish(true);
+    m_thread.join();
+  }
+};
+
 struct WAVOutVoiceEngine : BaseAudioVoiceEngine {
   std::vector<float> m_interleavedBuf;
+  std::vector<float> m_renderBuf;
 
   AudioChannelSet _getAvailableSet() { return AudioChannelSet::Stereo; }
 
@@ -57,6 +160,22 @@ struct WAVOutVoiceEngine : BaseAudioVoiceEngine {
 
   FILE* m_fp = nullptr;
   size_t m_bytesWritten = 0;
+  WAVFormat m_format;
+  bool m_dither;
+  DitherState m_ditherState;
+  std::unique_ptr<WAVOutWriter> m_writer;
+
+  size_t _bytesPerSample() const {
+    switch (m_format) {
+    case WAVFormat::Int16:
+      return 2;
+    case WAVFormat::Int24:
+      return 3;
+    case WAVFormat::Float32:
+    default:
+      return 4;
+    }
+  }
 
   void prepareWAV(double sampleRate, int numChans) {
     uint32_t speakerMask = 0;
@@ -121,17 +240,17 @@ struct WAVOutVoiceEngine : BaseAudioVoiceEngine {
       fwrite("fmt ", 1, 4, m_fp);
       uint32_t sixteen = 16;
       fwrite(&sixteen, 1, 4, m_fp);
-      uint16_t audioFmt = 3;
+      uint16_t audioFmt = m_format == WAVFormat::Float32 ? 3 : 1;
       fwrite(&audioFmt, 1, 2, m_fp);
       uint16_t chCount = numChans;
       fwrite(&chCount, 1, 2, m_fp);
       uint32_t sampRate = sampleRate;
       fwrite(&sampRate, 1, 4, m_fp);
-      uint16_t blockAlign = 4 * numChans;
+      uint16_t blockAlign = _bytesPerSample() * numChans;
       uint32_t byteRate = sampRate * blockAlign;
       fwrite(&byteRate, 1, 4, m_fp);
       fwrite(&blockAlign, 1, 2, m_fp);
-      uint16_t bps = 32;
+      uint16_t bps = _bytesPerSample() * 8;
       fwrite(&bps, 1, 2, m_fp);
 
       fwrite("data", 1, 4, m_fp);
@@ -153,17 +272,20 @@ struct WAVOutVoiceEngine : BaseAudioVoiceEngine {
       fwrite(&chCount, 1, 2, m_fp);
       uint32_t sampRate = sampleRate;
       fwrite(&sampRate, 1, 4, m_fp);
-      uint16_t blockAlign = 4 * numChans;
+      uint16_t blockAlign = _bytesPerSample() * numChans;
       uint32_t byteRate = sampRate * blockAlign;
       fwrite(&byteRate, 1, 4, m_fp);
       fwrite(&blockAlign, 1, 2, m_fp);
-      uint16_t bps = 32;
+      uint16_t bps = _bytesPerSample() * 8;
       fwrite(&bps, 1, 2, m_fp);
       uint16_t extSize = 22;
       fwrite(&extSize, 1, 2, m_fp);
       fwrite(&bps, 1, 2, m_fp);
       fwrite(&speakerMask, 1, 4, m_fp);
-      fwrite("\x03\x00\x00\x00\x00\x00\x10\x00\x80\x00\x00\xaa\x00\x38\x9b\x71", 1, 16, m_fp);
+      if (m_format == WAVFormat::Float32)
+        fwrite("\x03\x00\x00\x00\x00\x00\x10\x00\x80\x00\x00\xaa\x00\x38\x9b\x71", 1, 16, m_fp);
+      else
+        fwrite("\x01\x00\x00\x00\x00\x00\x10\x00\x80\x00\x00\xaa\x00\x38\x9b\x71", 1, 16, m_fp);
 
       fwrite("data", 1, 4, m_fp);
       fwrite(&dataSize, 1, 4, m_fp);
@@ -174,10 +296,14 @@ struct WAVOutVoiceEngine : BaseAudioVoiceEngine {
     m_mixInfo.m_sampleFormat = SOXR_FLOAT32_I;
     m_mixInfo.m_bitsPerSample = 32;
     _buildAudioRenderClient();
+
+    size_t frameSz = _bytesPerSample() * m_mixInfo.m_channelMap.m_channelCount;
+    m_writer = std::make_unique<WAVOutWriter>(m_fp, m_5msFrames * RenderBlockPeriods * frameSz);
   }
 
 #if _WIN32
-  WAVOutVoiceEngine(const char* path, double sampleRate, int numChans) {
+  WAVOutVoiceEngine(const char* path, double sampleRate, int numChans, WAVFormat format, bool dither)
+  : m_format(format), m_dither(dither) {
     const nowide::wstackstring wpath(path);
     m_fp = _wfopen(wpath.get(), L"wb");
     if (!m_fp)
@@ -185,7 +311,8 @@ struct WAVOutVoiceEngine : BaseAudioVoiceEngine {
     prepareWAV(sampleRate, numChans);
   }
 #else
-  WAVOutVoiceEngine(const char* path, double sampleRate, int numChans) {
+  WAVOutVoiceEngine(const char* path, double sampleRate, int numChans, WAVFormat format, bool dither)
+  : m_format(format), m_dither(dither) {
     m_fp = fopen(path, "wb");
     if (!m_fp)
       return;
@@ -194,6 +321,11 @@ struct WAVOutVoiceEngine : BaseAudioVoiceEngine {
 #endif
 
   void finishWav() {
+    if (!m_fp)
+      return;
+    if (m_writer)
+      m_writer->finish();
+
     uint32_t dataSize = m_bytesWritten;
 
     if (m_mixInfo.m_channelMap.m_channelCount == 2) {
@@ -229,17 +361,72 @@ struct WAVOutVoiceEngine : BaseAudioVoiceEngine {
     _resetSampleRate();
   }
 
+  /* Convert mixed frames to the file format and queue them for the disk thread */
+  void _writeFrames(const float* data, size_t frames) {
+    size_t bytesPerSample = _bytesPerSample();
+    size_t remSamples = frames * m_mixInfo.m_channelMap.m_channelCount;
+    DitherState* dither = m_dither ? &m_ditherState : nullptr;
+    m_bytesWritten += remSamples * bytesPerSample;
+    while (remSamples) {
+      size_t bytesAvail;
+      uint8_t* out = m_writer->beginWrite(bytesAvail);
+      size_t thisSamples = std::min(remSamples, bytesAvail / bytesPerSample);
+      switch (m_format) {
+      case WAVFormat::Int16:
+        ConvertToInt16(data, reinterpret_cast<int16_t*>(out), thisSamples, 1.f, dither);
+        break;
+      case WAVFormat::Int24:
+        ConvertToInt24(data, out, thisSamples, 1.f, dither);
+        break;
+      case WAVFormat::Float32:
+      default:
+        memcpy(out, data, thisSamples * 4);
+        break;
+      }
+      m_writer->endWrite(thisSamples * bytesPerSample);
+      data += thisSamples;
+      remSamples -= thisSamples;
+    }
+  }
+
   void pumpAndMixVoices() override {
     OPTICK_EVENT();
-    size_t frameSz = 4 * m_mixInfo.m_channelMap.m_channelCount;
     _pumpAndMixVoices(m_5msFrames, m_interleavedBuf.data());
-    fwrite(m_interleavedBuf.data(), 1, m_5msFrames * frameSz, m_fp);
-    m_bytesWritten += m_5msFrames * frameSz;
+    _writeFrames(m_interleavedBuf.data(), m_5msFrames);
+  }
+
+  AudioRenderStats renderFrames(size_t frames) override {
+    OPTICK_EVENT();
+    AudioRenderStats stats;
+    size_t chanCount = m_mixInfo.m_channelMap.m_channelCount;
+    size_t blockFrames = m_5msFrames * RenderBlockPeriods;
+    if (m_renderBuf.size() < blockFrames * chanCount)
+      m_renderBuf.resize(blockFrames * chanCount);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t remFrames = frames;
+    while (remFrames) {
+      size_t thisFrames = std::min(remFrames, blockFrames);
+      _pumpAndMixVoices(thisFrames, m_renderBuf.data());
+      _writeFrames(m_renderBuf.data(), thisFrames);
+      remFrames -= thisFrames;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    stats.m_frames = frames;
+    stats.m_wallSeconds = elapsed.count();
+    if (stats.m_wallSeconds > 0.0) {
+      stats.m_framesPerSecond = frames / stats.m_wallSeconds;
+      stats.m_realtimeFactor = stats.m_framesPerSecond / m_mixInfo.m_sampleRate;
+    }
+    return stats;
   }
 };
 
-std::unique_ptr<IAudioVoiceEngine> NewWAVAudioVoiceEngine(const char* path, double sampleRate, int numChans) {
-  std::unique_ptr<IAudioVoiceEngine> ret = std::make_unique<WAVOutVoiceEngine>(path, sampleRate, numChans);
+std::unique_ptr<IAudioVoiceEngine> NewWAVAudioVoiceEngine(const char* path, double sampleRate, int numChans,
+                                                          WAVFormat format, bool dither) {
+  std::unique_ptr<IAudioVoiceEngine> ret =
+      std::make_unique<WAVOutVoiceEngine>(path, sampleRate, numChans, format, dither);
   if (!static_cast<WAVOutVoiceEngine&>(*ret).m_fp)
     return {};
   return ret;
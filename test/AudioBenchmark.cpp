@@ -0,0 +1,335 @@
+/* Offline mixer benchmark on the null engine at 48 kHz. Each scenario reports how many voices a single
+ * core mixes in real time, found by rendering at a trial voice count and rescaling by the realtime factor
+ * until the count settles. Usage: audioBenchmark [scenario ...] (all scenarios when none are named) */
+
+#include "boo/audiodev/IAudioVoiceEngine.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846 /* pi */
+#endif
+
+using namespace boo;
+
+namespace {
+
+constexpr double MixRate = 48000.0;
+
+/* Seconds of audio rendered per trial, after a short untimed warm-up */
+constexpr double TrialSeconds = 1.0;
+constexpr double WarmupSeconds = 0.1;
+
+/* Voice-count search: starting guess, ceiling, and the relative change treated as settled */
+constexpr size_t InitialVoices = 64;
+constexpr size_t MaxVoices = 1 << 16;
+constexpr double SettledFraction = 0.02;
+constexpr int MaxTrials = 5;
+
+/* Measurements at a fixed voice count keep the fastest of this many trials to reject scheduling noise */
+constexpr int RepeatTrials = 3;
+
+/* Game frames timed per batch size in the pan scenario; the engine pumps untimed between them */
+constexpr int PanFrames = 200;
+
+/* Sources are read from a table so synthesis stays negligible next to the mixing being measured */
+constexpr size_t SineTableSize = 4096;
+
+const int16_t* SineTable() {
+  static const std::vector<int16_t> table = [] {
+    std::vector<int16_t> ret(SineTableSize);
+    for (size_t i = 0; i < SineTableSize; ++i)
+      ret[i] = int16_t(std::sin(i * 2.0 * M_PI / SineTableSize) * 8000.0);
+    return ret;
+  }();
+  return table.data();
+}
+
+struct SineSource : IAudioVoiceCallback {
+  unsigned m_channels;
+  size_t m_phase;
+  size_t m_step;
+  bool m_vibrato;
+  double m_time = 0.0;
+
+  SineSource(unsigned channels, size_t seed, bool vibrato)
+  : m_channels(channels), m_phase(seed * 97), m_step(20 + seed % 61), m_vibrato(vibrato) {}
+
+  void preSupplyAudio(IAudioVoice& voice, double dt) override {
+    /* Dynamic-pitch voices retune every quantum, as a pitch bend or doppler shift would */
+    if (!m_vibrato)
+      return;
+    m_time += dt;
+    voice.setPitchRatio(1.0 + 0.05 * std::sin(m_time * 6.0 + double(m_phase)), true);
+  }
+
+  size_t supplyAudio(IAudioVoice& voice, size_t frames, int16_t* data) override {
+    const int16_t* table = SineTable();
+    for (size_t f = 0; f < frames; ++f) {
+      int16_t sample = table[m_phase & (SineTableSize - 1)];
+      m_phase += m_step;
+      for (unsigned c = 0; c < m_channels; ++c)
+        *data++ = sample;
+    }
+    return frames;
+  }
+};
+
+/** Voices allocated for a trial */
+struct VoiceConfig {
+  const char* m_name;
+  unsigned m_channels = 1;
+  double m_sourceRate = 44100.0;
+  bool m_dynamicPitch = false;
+  AudioVoiceQuality m_quality = AudioVoiceQuality::High;
+};
+
+/** Engine settings applied before voices are allocated */
+struct EngineConfig {
+  int m_deviceChannels = 2;
+  bool m_ltRt = false;
+  size_t m_quantum = 0;
+};
+
+struct TrialResult {
+  double m_realtimeFactor = 0.0;
+  AudioEngineStats m_stats;
+};
+
+TrialResult RunTrial(const VoiceConfig& voiceConfig, const EngineConfig& engineConfig, size_t voiceCount) {
+  std::unique_ptr<IAudioVoiceEngine> engine = NewNullAudioVoiceEngine(MixRate, engineConfig.m_deviceChannels);
+  if (engineConfig.m_ltRt && !engine->enableLtRt(true))
+    fprintf(stderr, "Lt/Rt encoding unavailable; measuring plain stereo\n");
+  if (engineConfig.m_quantum)
+    engine->setMixQuantum(engineConfig.m_quantum);
+
+  std::vector<std::unique_ptr<SineSource>> sources;
+  std::vector<ObjToken<IAudioVoice>> voices;
+  sources.reserve(voiceCount);
+  voices.reserve(voiceCount);
+  const float monoLevels[8] = {0.5f, 0.5f, 0.3f, 0.1f, 0.3f, 0.3f, 0.2f, 0.2f};
+  const float stereoLevels[8][2] = {{0.5f, 0.f}, {0.f, 0.5f}, {0.2f, 0.2f}, {0.1f, 0.1f},
+                                    {0.3f, 0.f}, {0.f, 0.3f}, {0.2f, 0.f}, {0.f, 0.2f}};
+  for (size_t i = 0; i < voiceCount; ++i) {
+    auto& source = sources.emplace_back(
+        std::make_unique<SineSource>(voiceConfig.m_channels, i, voiceConfig.m_dynamicPitch));
+    ObjToken<IAudioVoice> voice =
+        voiceConfig.m_channels == 2
+            ? engine->allocateNewStereoVoice(voiceConfig.m_sourceRate, source.get(), voiceConfig.m_dynamicPitch,
+                                             voiceConfig.m_quality)
+            : engine->allocateNewMonoVoice(voiceConfig.m_sourceRate, source.get(), voiceConfig.m_dynamicPitch,
+                                           voiceConfig.m_quality);
+    if (voiceConfig.m_channels == 2)
+      voice->setStereoChannelLevels(nullptr, stereoLevels, false);
+    else
+      voice->setMonoChannelLevels(nullptr, monoLevels, false);
+    voice->start();
+    voices.push_back(std::move(voice));
+  }
+
+  engine->renderSeconds(WarmupSeconds);
+  engine->resetStats();
+  AudioRenderStats render = engine->renderSeconds(TrialSeconds);
+
+  TrialResult ret;
+  ret.m_realtimeFactor = render.m_realtimeFactor;
+  ret.m_stats = engine->getStats();
+  voices.clear();
+  return ret;
+}
+
+TrialResult BestTrial(const VoiceConfig& voiceConfig, const EngineConfig& engineConfig, size_t voiceCount) {
+  TrialResult best;
+  for (int trial = 0; trial < RepeatTrials; ++trial) {
+    TrialResult result = RunTrial(voiceConfig, engineConfig, voiceCount);
+    if (result.m_realtimeFactor > best.m_realtimeFactor)
+      best = result;
+  }
+  return best;
+}
+
+/* Rescale the voice count by each trial's realtime factor until it settles on the count one core sustains */
+size_t MaxVoicesPerCore(const VoiceConfig& voiceConfig, const EngineConfig& engineConfig) {
+  size_t voices = InitialVoices;
+  for (int trial = 0; trial < MaxTrials; ++trial) {
+    double factor = RunTrial(voiceConfig, engineConfig, voices).m_realtimeFactor;
+    size_t next = std::min(std::max(size_t(voices * factor), size_t(1)), MaxVoices);
+    bool settled = std::fabs(double(next) - double(voices)) <= voices * SettledFraction;
+    voices = next;
+    if (settled)
+      break;
+  }
+  return voices;
+}
+
+void PrintVoices(const char* name, size_t voices) { printf("  %-36s %7zu voices/core\n", name, voices); }
+
+void BenchVoices() {
+  printf("Max voices per core, 44.1 kHz sources mixed to 48 kHz stereo:\n");
+  const VoiceConfig configs[] = {
+      {"mono"},
+      {"stereo", 2},
+      {"mono, dynamic pitch", 1, 44100.0, true},
+  };
+  for (const VoiceConfig& config : configs)
+    PrintVoices(config.m_name, MaxVoicesPerCore(config, {}));
+}
+
+void BenchQuality() {
+  printf("Resampler cost per quality tier, 44.1 kHz mono sources mixed to 48 kHz stereo:\n");
+  const VoiceConfig configs[] = {
+      {"quick", 1, 44100.0, false, AudioVoiceQuality::Quick},
+      {"low", 1, 44100.0, false, AudioVoiceQuality::Low},
+      {"medium", 1, 44100.0, false, AudioVoiceQuality::Medium},
+      {"high", 1, 44100.0, false, AudioVoiceQuality::High},
+      {"very high", 1, 44100.0, false, AudioVoiceQuality::VeryHigh},
+      {"quick, dynamic pitch", 1, 44100.0, true, AudioVoiceQuality::Quick},
+      {"high, dynamic pitch", 1, 44100.0, true, AudioVoiceQuality::High},
+  };
+  for (const VoiceConfig& config : configs) {
+    size_t voices = MaxVoicesPerCore(config, {});
+    printf("  %-36s %7zu voices/core %9.1f us per voice-second\n", config.m_name, voices, 1.0e6 / voices);
+  }
+}
+
+/* Only uses interfaces that predate in-place Lt/Rt mixing, so the scenario also builds against earlier revisions
+ * for before/after comparisons */
+void BenchLtRt() {
+  constexpr size_t Voices = 64;
+  printf("Lt/Rt encoding, %zu 44.1 kHz mono voices mixed to 48 kHz stereo:\n", Voices);
+  const VoiceConfig config{"mono"};
+  for (bool ltRt : {false, true}) {
+    EngineConfig engineConfig;
+    engineConfig.m_ltRt = ltRt;
+    TrialResult result = BestTrial(config, engineConfig, Voices);
+    const AudioEngineStats& stats = result.m_stats;
+    printf("  %-36s %9.1f us mix %9.1f us encode per audio second, %7zu voices/core\n",
+           ltRt ? "Lt/Rt from 5.0 mix" : "plain stereo", 1.0e6 / result.m_realtimeFactor,
+           stats.m_ltRtSeconds * 1.0e6 / TrialSeconds, MaxVoicesPerCore(config, engineConfig));
+  }
+}
+
+void BenchQuantum() {
+  printf("Mix quantum sweep, 44.1 kHz sources mixed to 48 kHz stereo:\n");
+  const VoiceConfig configs[] = {
+      {"mono"},
+      {"mono, dynamic pitch", 1, 44100.0, true},
+  };
+  for (const VoiceConfig& config : configs) {
+    printf("  %s\n", config.m_name);
+    EngineConfig engineConfig;
+    printf("    %-34s %7zu voices/core\n", "5ms (240 frames)", MaxVoicesPerCore(config, engineConfig));
+    for (size_t frames = MinMixQuantumFrames; frames <= MaxMixQuantumFrames; frames *= 2) {
+      engineConfig.m_quantum = frames;
+      char name[32];
+      snprintf(name, sizeof(name), "%zu frames", frames);
+      printf("    %-34s %7zu voices/core\n", name, MaxVoicesPerCore(config, engineConfig));
+    }
+  }
+}
+
+/* Game-thread cost of placing voices: setVoicePans against the same voices given precomputed levels one call
+ * at a time, which only measures queueing. Voices are not started, so the untimed pump between frames just
+ * drains the commands */
+void BenchPan() {
+  printf("Game-thread cost of setVoicePans per frame, 48 kHz 7.1 output:\n");
+  const float monoLevels[8] = {0.5f, 0.5f, 0.3f, 0.1f, 0.3f, 0.3f, 0.2f, 0.2f};
+  const float stereoLevels[8][2] = {{0.5f, 0.f}, {0.f, 0.5f}, {0.2f, 0.2f}, {0.1f, 0.1f},
+                                    {0.3f, 0.f}, {0.f, 0.3f}, {0.2f, 0.f}, {0.f, 0.2f}};
+  for (unsigned channels : {1u, 2u}) {
+    for (size_t voiceCount : {size_t(16), size_t(256), size_t(1024)}) {
+      std::unique_ptr<IAudioVoiceEngine> engine = NewNullAudioVoiceEngine(MixRate, 8);
+      std::vector<std::unique_ptr<SineSource>> sources;
+      std::vector<ObjToken<IAudioVoice>> voices;
+      std::vector<AudioVoicePan> pans(voiceCount);
+      for (size_t i = 0; i < voiceCount; ++i) {
+        auto& source = sources.emplace_back(std::make_unique<SineSource>(channels, i, false));
+        voices.push_back(channels == 2 ? engine->allocateNewStereoVoice(44100.0, source.get())
+                                       : engine->allocateNewMonoVoice(44100.0, source.get()));
+        pans[i].m_voice = voices.back().get();
+        pans[i].m_width = 0.5f;
+      }
+
+      double panSeconds = 0.0;
+      double levelSeconds = 0.0;
+      for (int frame = 0; frame < PanFrames; ++frame) {
+        /* Orbit the sources so every frame pans to new positions */
+        for (size_t i = 0; i < voiceCount; ++i) {
+          double angle = (frame + i * 7) * 0.01;
+          pans[i].m_position[0] = float(std::sin(angle) * 4.0);
+          pans[i].m_position[2] = float(std::cos(angle) * 4.0);
+          pans[i].m_spread = float(i % 4) * 0.25f;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        engine->setVoicePans(pans.data(), voiceCount, true);
+        panSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        engine->pumpAndMixVoices();
+
+        start = std::chrono::steady_clock::now();
+        for (ObjToken<IAudioVoice>& voice : voices) {
+          if (channels == 2)
+            voice->setStereoChannelLevels(nullptr, stereoLevels, true);
+          else
+            voice->setMonoChannelLevels(nullptr, monoLevels, true);
+        }
+        levelSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        engine->pumpAndMixVoices();
+      }
+
+      char name[32];
+      snprintf(name, sizeof(name), "%zu %s voices", voiceCount, channels == 2 ? "stereo" : "mono");
+      printf("  %-36s %9.2f us per call %7.1f ns per voice (%.1f ns queueing levels)\n", name,
+             panSeconds * 1.0e6 / PanFrames, panSeconds * 1.0e9 / (PanFrames * voiceCount),
+             levelSeconds * 1.0e9 / (PanFrames * voiceCount));
+      voices.clear();
+    }
+  }
+}
+
+struct Scenario {
+  const char* m_name;
+  void (*m_run)();
+};
+
+constexpr Scenario Scenarios[] = {
+    {"voices", BenchVoices},
+    {"quality", BenchQuality},
+    {"ltrt", BenchLtRt},
+    {"quantum", BenchQuantum},
+    {"pan", BenchPan},
+};
+
+} // Anonymous namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    for (const Scenario& scenario : Scenarios)
+      scenario.m_run();
+    return EXIT_SUCCESS;
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    const Scenario* found = nullptr;
+    for (const Scenario& scenario : Scenarios)
+      if (!strcmp(argv[i], scenario.m_name))
+        found = &scenario;
+    if (!found) {
+      fprintf(stderr, "unknown scenario '%s'; available:", argv[i]);
+      for (const Scenario& scenario : Scenarios)
+        fprintf(stderr, " %s", scenario.m_name);
+      fprintf(stderr, "\n");
+      return EXIT_FAILURE;
+    }
+    found->m_run();
+  }
+  return EXIT_SUCCESS;
+}
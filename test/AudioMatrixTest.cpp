@@ -0,0 +1,176 @@
+/* Compares the vectorized matrix kernels against the scalar AudioMatrix.cpp mixers for every
+ * kernel layout and sample format, across slews that start and end mid-call */
+
+#include "lib/audiodev/AudioMatrix.hpp"
+#include "lib/audiodev/AudioMatrixKernels.hpp"
+#include "lib/audiodev/Common.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace boo;
+
+namespace {
+
+constexpr ChannelMap Layouts[] = {
+    {2, {AudioChannel::FrontLeft, AudioChannel::FrontRight}},
+    {4, {AudioChannel::FrontLeft, AudioChannel::FrontRight, AudioChannel::RearLeft, AudioChannel::RearRight}},
+    {6,
+     {AudioChannel::FrontLeft, AudioChannel::FrontRight, AudioChannel::FrontCenter, AudioChannel::LFE,
+      AudioChannel::RearLeft, AudioChannel::RearRight}},
+    {8,
+     {AudioChannel::FrontLeft, AudioChannel::FrontRight, AudioChannel::FrontCenter, AudioChannel::LFE,
+      AudioChannel::RearLeft, AudioChannel::RearRight, AudioChannel::SideLeft, AudioChannel::SideRight}},
+};
+
+/* Call sizes exercising both the whole-period loops and the per-frame remainders of each kernel */
+constexpr size_t Chunks[] = {1, 3, 37, 100, 5, 255, 64};
+constexpr size_t SlewFrames = 160;
+
+std::mt19937 Rand(1234);
+
+template <typename T>
+T RandomSample() {
+  /* Mostly in range, occasionally loud enough to exercise integer clipping */
+  std::uniform_real_distribution<float> dist(-1.2f, 1.2f);
+  if constexpr (std::is_same_v<T, int16_t>)
+    return Clamp16(dist(Rand) * 32767.f);
+  else if constexpr (std::is_same_v<T, int32_t>)
+    return Clamp32(dist(Rand) * 2147483520.f);
+  else
+    return dist(Rand);
+}
+
+template <typename T>
+bool Matches(T ref, T test) {
+  /* The scalar mixers interpolate in double precision, the kernels in single precision, whose 24-bit
+   * mantissa resolves full-scale int32 sums only to within a few hundred steps */
+  if constexpr (std::is_same_v<T, int16_t>)
+    return std::abs(int(ref) - int(test)) <= 1;
+  else if constexpr (std::is_same_v<T, int32_t>)
+    return std::fabs(double(ref) - double(test)) <= 1024.0;
+  else
+    return std::fabs(ref - test) <= std::max(1e-5f, std::fabs(ref) * 1e-5f);
+}
+
+template <typename T>
+const char* FormatName() {
+  if constexpr (std::is_same_v<T, int16_t>)
+    return "int16";
+  else if constexpr (std::is_same_v<T, int32_t>)
+    return "int32";
+  else
+    return "float";
+}
+
+template <typename T, bool Stereo>
+bool CompareLayout(const char* isa, const AudioMatrixKernels& kernels, const ChannelMap& chMap) {
+  AudioVoiceEngineMixInfo info;
+  info.m_channelMap = chMap;
+  const unsigned chanCount = chMap.m_channelCount;
+  const unsigned inStride = Stereo ? 2 : 1;
+
+  std::uniform_real_distribution<float> coefDist(-0.5f, 1.5f);
+  float oldCoefs[8][2], newCoefs[8][2];
+  for (int i = 0; i < 8; ++i)
+    for (int j = 0; j < 2; ++j) {
+      oldCoefs[i][j] = coefDist(Rand);
+      newCoefs[i][j] = coefDist(Rand);
+    }
+
+  /* The scalar matrix only retains old coefficients once a previous slew has begun */
+  std::conditional_t<Stereo, AudioMatrixStereo, AudioMatrixMono> matrix;
+  T warm[2] = {};
+  T warmOut[16] = {};
+  if constexpr (Stereo) {
+    matrix.setMatrixCoefficients(oldCoefs, 1);
+    matrix.mixStereoSampleData(info, warm, warmOut, 1);
+    matrix.setMatrixCoefficients(newCoefs, SlewFrames);
+  } else {
+    float oldMono[8], newMono[8];
+    for (int i = 0; i < 8; ++i) {
+      oldMono[i] = oldCoefs[i][0];
+      newMono[i] = newCoefs[i][0];
+    }
+    matrix.setMatrixCoefficients(oldMono, 1);
+    matrix.mixMonoSampleData(info, warm, warmOut, 1);
+    matrix.setMatrixCoefficients(newMono, SlewFrames);
+  }
+
+  AudioMatrixParams params;
+  for (unsigned c = 0; c < chanCount; ++c) {
+    int ch = int(chMap.m_channels[c]);
+    params.m_coefs[c][0] = newCoefs[ch][0];
+    params.m_coefs[c][1] = Stereo ? newCoefs[ch][1] : 0.f;
+    params.m_oldCoefs[c][0] = oldCoefs[ch][0];
+    params.m_oldCoefs[c][1] = Stereo ? oldCoefs[ch][1] : 0.f;
+  }
+  params.m_slewFrames = SlewFrames;
+  size_t curSlewFrame = 0;
+  int slot = AudioMatrixKernelSlot(chanCount);
+  AudioMatrixMixFn<T> kernel = Stereo ? kernels.stereo<T>()[slot] : kernels.mono<T>()[slot];
+
+  size_t frameBase = 0;
+  for (size_t frames : Chunks) {
+    std::vector<T> in(frames * inStride);
+    std::vector<T> ref(frames * chanCount);
+    for (T& s : in)
+      s = RandomSample<T>();
+    for (T& s : ref)
+      s = RandomSample<T>();
+    std::vector<T> test = ref;
+
+    T* refEnd;
+    if constexpr (Stereo)
+      refEnd = matrix.mixStereoSampleData(info, in.data(), ref.data(), frames);
+    else
+      refEnd = matrix.mixMonoSampleData(info, in.data(), ref.data(), frames);
+    T* testEnd = kernel(params, in.data(), test.data(), frames, curSlewFrame);
+
+    if (refEnd != ref.data() + ref.size() || testEnd != test.data() + test.size()) {
+      fprintf(stderr, "%s %s %s %u channels: wrong output end after frame %zu\n", isa, Stereo ? "stereo" : "mono",
+              FormatName<T>(), chanCount, frameBase);
+      return false;
+    }
+    for (size_t i = 0; i < ref.size(); ++i) {
+      if (!Matches(ref[i], test[i])) {
+        fprintf(stderr, "%s %s %s %u channels: frame %zu channel %zu is %g, expected %g\n", isa,
+                Stereo ? "stereo" : "mono", FormatName<T>(), chanCount, frameBase + i / chanCount, i % chanCount,
+                double(test[i]), double(ref[i]));
+        return false;
+      }
+    }
+    frameBase += frames;
+  }
+  return true;
+}
+
+template <typename T>
+bool CompareFormat(const char* isa, const AudioMatrixKernels& kernels) {
+  bool ok = true;
+  for (const ChannelMap& chMap : Layouts) {
+    ok &= CompareLayout<T, false>(isa, kernels, chMap);
+    ok &= CompareLayout<T, true>(isa, kernels, chMap);
+  }
+  return ok;
+}
+
+bool CompareKernels(const char* isa, const AudioMatrixKernels& kernels) {
+  bool ok = CompareFormat<int16_t>(isa, kernels);
+  ok &= CompareFormat<int32_t>(isa, kernels);
+  ok &= CompareFormat<float>(isa, kernels);
+  printf("%s kernels: %s\n", isa, ok ? "match" : "MISMATCH");
+  return ok;
+}
+
+} // Anonymous namespace
+
+int main() {
+  bool ok = CompareKernels("baseline", GetBaseAudioMatrixKernels());
+  if (&GetAudioMatrixKernels() != &GetBaseAudioMatrixKernels())
+    ok &= CompareKernels("selected", GetAudioMatrixKernels());
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
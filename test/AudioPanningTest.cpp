@@ -0,0 +1,151 @@
+/* Checks ComputePanGains for every speaker layout: the vectorized batches against the scalar tail, and the
+ * gains themselves for unit power, silent LFE and absent channels, even spreading of sources without a
+ * bearing, and the separation of stereo sources */
+
+#include "lib/audiodev/AudioPanning.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+
+using namespace boo;
+
+namespace {
+
+constexpr ChannelMap Layouts[] = {
+    {2, {AudioChannel::FrontLeft, AudioChannel::FrontRight}},
+    {4, {AudioChannel::FrontLeft, AudioChannel::FrontRight, AudioChannel::RearLeft, AudioChannel::RearRight}},
+    {6,
+     {AudioChannel::FrontLeft, AudioChannel::FrontRight, AudioChannel::FrontCenter, AudioChannel::LFE,
+      AudioChannel::RearLeft, AudioChannel::RearRight}},
+    {8,
+     {AudioChannel::FrontLeft, AudioChannel::FrontRight, AudioChannel::FrontCenter, AudioChannel::LFE,
+      AudioChannel::RearLeft, AudioChannel::RearRight, AudioChannel::SideLeft, AudioChannel::SideRight}},
+};
+
+struct Source {
+  float m_position[3];
+  float m_spread;
+  float m_gain;
+};
+
+constexpr Source Sources[] = {
+    {{0.f, 0.f, 1.f}, 0.f, 1.f},     {{-1.f, 0.f, 0.f}, 0.f, 1.f},   {{1.f, 0.f, 0.f}, 0.f, 0.5f},
+    {{0.f, 0.f, -1.f}, 0.f, 1.f},    {{-3.f, 0.f, 3.f}, 0.f, 2.f},   {{2.f, 1.f, -5.f}, 0.f, 1.f},
+    {{0.3f, 0.f, 0.1f}, 0.5f, 1.f},  {{-0.7f, 0.f, -0.2f}, 1.f, 1.f}, {{1e4f, 0.f, 1e4f}, 0.25f, 0.8f},
+    {{0.f, 0.f, 0.f}, 0.f, 1.f},     {{0.f, 1.f, 0.f}, 0.f, 1.f},    {{0.f, -2.f, 0.f}, 0.3f, 0.7f},
+    {{1e-7f, 0.f, 1e-7f}, 0.f, 1.f},
+};
+
+/* The vector path divides and takes square roots in single precision like the scalar tail, but may
+ * associate its sums differently */
+bool Matches(float ref, float test) { return std::fabs(ref - test) <= std::max(1e-6f, std::fabs(ref) * 1e-5f); }
+
+void Present(const ChannelMap& chMap, bool present[8]) {
+  std::fill(present, present + 8, false);
+  for (unsigned c = 0; c < chMap.m_channelCount; ++c)
+    if (chMap.m_channels[c] != AudioChannel::LFE)
+      present[int(chMap.m_channels[c])] = true;
+}
+
+void AddSource(AudioPanBatch& batch, const Source& src) {
+  batch.add(src.m_position[0], src.m_position[1], src.m_position[2], src.m_spread, src.m_gain);
+}
+
+/* Pans each source in all four lanes of a vector and again in the scalar tail */
+bool CompareBatch(const ChannelMap& chMap, const Source& src, size_t srcIdx) {
+  AudioPanBatch batch;
+  for (int i = 0; i < 5; ++i)
+    AddSource(batch, src);
+  ComputePanGains(chMap, batch);
+
+  bool present[8];
+  Present(chMap, present);
+  float power = 0.f;
+  for (int c = 0; c < 8; ++c) {
+    float ref = batch.m_gains[c][4];
+    for (int lane = 0; lane < 4; ++lane) {
+      if (!Matches(ref, batch.m_gains[c][lane])) {
+        fprintf(stderr, "%u channels, source %zu: channel %d lane %d is %g, scalar %g\n", chMap.m_channelCount,
+                srcIdx, c, lane, double(batch.m_gains[c][lane]), double(ref));
+        return false;
+      }
+    }
+    if (!present[c] && ref != 0.f) {
+      fprintf(stderr, "%u channels, source %zu: absent or LFE channel %d has gain %g\n", chMap.m_channelCount,
+              srcIdx, c, double(ref));
+      return false;
+    }
+    power += ref * ref;
+  }
+
+  if (std::fabs(std::sqrt(power) - src.m_gain) > src.m_gain * 1e-4f) {
+    fprintf(stderr, "%u channels, source %zu: amplitude %g, expected %g\n", chMap.m_channelCount, srcIdx,
+            double(std::sqrt(power)), double(src.m_gain));
+    return false;
+  }
+
+  /* Sources at the listener or straight above or below have no bearing and play evenly everywhere */
+  const float* pos = src.m_position;
+  if (pos[0] * pos[0] + pos[2] * pos[2] <= 1e-12f) {
+    float even = -1.f;
+    for (int c = 0; c < 8; ++c) {
+      if (!present[c])
+        continue;
+      if (even < 0.f)
+        even = batch.m_gains[c][4];
+      else if (!Matches(even, batch.m_gains[c][4])) {
+        fprintf(stderr, "%u channels, source %zu: uneven gain %g on channel %d, expected %g\n",
+                chMap.m_channelCount, srcIdx, double(batch.m_gains[c][4]), c, double(even));
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/* Stereo sources ahead of the listener: width pulls the left channel left and the right one right */
+bool CheckStereoWidth(const ChannelMap& chMap) {
+  const float ahead[3] = {0.f, 0.f, 2.f};
+  AudioPanBatch batch;
+  batch.addStereo(ahead, 0.f, 0.f, 1.f);
+  batch.addStereo(ahead, 0.5f, 0.f, 1.f);
+  batch.addStereo(ahead, 1.f, 0.f, 1.f);
+  ComputePanGains(chMap, batch);
+
+  const int fl = int(AudioChannel::FrontLeft);
+  const int fr = int(AudioChannel::FrontRight);
+  for (int c = 0; c < 8; ++c) {
+    if (!Matches(batch.m_gains[c][0], batch.m_gains[c][1])) {
+      fprintf(stderr, "%u channels: stereo channels differ on channel %d without width\n", chMap.m_channelCount, c);
+      return false;
+    }
+  }
+  float prevSeparation = 0.f;
+  for (size_t s = 2; s < 6; s += 2) {
+    float separation =
+        (batch.m_gains[fl][s] - batch.m_gains[fr][s]) + (batch.m_gains[fr][s + 1] - batch.m_gains[fl][s + 1]);
+    if (separation <= prevSeparation) {
+      fprintf(stderr, "%u channels: stereo separation %g does not grow with width\n", chMap.m_channelCount,
+              double(separation));
+      return false;
+    }
+    prevSeparation = separation;
+  }
+  return true;
+}
+
+} // Anonymous namespace
+
+int main() {
+  bool ok = true;
+  for (const ChannelMap& chMap : Layouts) {
+    for (size_t s = 0; s < std::size(Sources); ++s)
+      ok &= CompareBatch(chMap, Sources[s], s);
+    ok &= CheckStereoWidth(chMap);
+  }
+  printf("pan gains: %s\n", ok ? "match" : "MISMATCH");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}